@@ -0,0 +1,190 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <iterator>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "almost_always_lockfree_queue.h"
+#include "lockfree_spsc.h"
+
+namespace
+{
+using benchmark_clock = std::chrono::steady_clock;
+
+/**
+ * @brief The previous almost_always_lockfree_queue, which spilled into a
+ * mutex protected deque once the ring was full. Kept here as the baseline.
+ */
+template <typename T>
+class locked_extension_queue
+{
+public:
+  explicit locked_extension_queue(size_t lockfree_size)
+      : _base_queue(lockfree_size)
+  {
+  }
+
+  void push(T&& item)
+  {
+    const bool using_extension =
+        _extension_size.load(std::memory_order_acquire);
+
+    if (!using_extension && _base_queue.try_push(std::forward<T>(item)))
+    {
+      return;
+    }
+
+    std::lock_guard l(_m);
+    _extension.push_back(std::forward<T>(item));
+    _extension_size.fetch_add(1, std::memory_order_release);
+  }
+
+  bool try_pop(T& popped)
+  {
+    if (_base_queue.try_pop(popped))
+    {
+      return true;
+    }
+
+    if (_extension_size.load(std::memory_order_acquire))
+    {
+      std::lock_guard l(_m);
+      popped = _extension.front();
+      _extension.pop_front();
+      _extension_size.fetch_sub(1, std::memory_order_release);
+      return true;
+    }
+
+    return false;
+  }
+
+private:
+  lockfree_spsc<T> _base_queue;
+  std::deque<T> _extension;
+  std::atomic_int _extension_size{};
+  std::mutex _m;
+};
+
+struct burst_timings
+{
+  double absorb_ns_per_item{};
+  double drain_ns_per_item{};
+};
+
+/**
+ * @brief The consumer drains in batches where the queue supports it, one item
+ * at a time otherwise.
+ */
+template <typename Queue>
+size_t drain(Queue& q, std::vector<uint64_t>& popped)
+{
+  if constexpr (requires { q.try_pop_n(std::back_inserter(popped), 256); })
+  {
+    return q.try_pop_n(std::back_inserter(popped), 256);
+  }
+  else
+  {
+    uint64_t item{};
+    if (q.try_pop(item))
+    {
+      popped.push_back(item);
+      return 1;
+    }
+    return 0;
+  }
+}
+
+/**
+ * @brief Throws "bursts" bursts of "burst_size" items at a queue with a ring
+ * of "ring_size" while a consumer drains it, and returns how long, per item,
+ * the producer took to push a burst and the consumer took to receive it.
+ */
+template <typename Queue>
+burst_timings measure_bursts(size_t ring_size, uint64_t burst_size, int bursts)
+{
+  Queue q(ring_size);
+  std::atomic<benchmark_clock::time_point> burst_start{};
+
+  burst_timings timings;
+
+  std::jthread consumer(
+      [&q, &burst_start, &timings, burst_size, bursts]
+      {
+        std::vector<uint64_t> popped;
+        popped.reserve(burst_size);
+        for (int burst = 0; burst < bursts; ++burst)
+        {
+          popped.clear();
+          while (popped.size() != burst_size)
+          {
+            drain(q, popped);
+          }
+          const std::chrono::duration<double, std::nano> elapsed =
+              benchmark_clock::now() - burst_start.load();
+          timings.drain_ns_per_item += elapsed.count();
+
+          // The baseline does not always keep the order, only check that
+          // everything arrived.
+          const uint64_t checksum = std::accumulate(popped.begin(), popped.end(), uint64_t{});
+          if (checksum != burst_size * (burst_size - 1) / 2)
+          {
+            fmt::print(stderr, "Corrupted stream, checksum {}\n", checksum);
+            std::exit(EXIT_FAILURE);
+          }
+        }
+      });
+
+  for (int burst = 0; burst < bursts; ++burst)
+  {
+    const auto start = benchmark_clock::now();
+    burst_start = start;
+    for (uint64_t i = 0; i < burst_size; ++i)
+    {
+      q.push(uint64_t{i});
+    }
+    const std::chrono::duration<double, std::nano> elapsed =
+        benchmark_clock::now() - start;
+    timings.absorb_ns_per_item += elapsed.count();
+
+    // Let the consumer catch up, we want to time separate bursts.
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+  consumer.join();
+
+  const double items = static_cast<double>(burst_size) * bursts;
+  timings.absorb_ns_per_item /= items;
+  timings.drain_ns_per_item /= items;
+  return timings;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+  const size_t ring_size = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1024;
+  const int bursts = argc > 2 ? std::atoi(argv[2]) : 10;
+
+  fmt::print("ring size {}, {} bursts, ns per item\n", ring_size, bursts);
+  for (const uint64_t burst_size : {1'000, 100'000, 1'000'000})
+  {
+    const burst_timings before =
+        measure_bursts<locked_extension_queue<uint64_t>>(ring_size, burst_size, bursts);
+    const burst_timings after =
+        measure_bursts<almost_always_lockfree_queue<uint64_t>>(ring_size, burst_size, bursts);
+
+    fmt::print("burst {:>8}: locked extension push {:6.1f} pop {:6.1f}, "
+               "lockfree segments push {:6.1f} pop {:6.1f}\n",
+               burst_size,
+               before.absorb_ns_per_item,
+               before.drain_ns_per_item,
+               after.absorb_ns_per_item,
+               after.drain_ns_per_item);
+  }
+
+  return 0;
+}
@@ -0,0 +1,116 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <thread>
+
+#include <fmt/core.h>
+
+#include "lockfree_spsc.h"
+
+namespace
+{
+using benchmark_clock = std::chrono::steady_clock;
+
+/**
+ * @brief Pushes "messages" integers through a queue of "ring_size" from one
+ * thread to another and returns the number of messages per second.
+ */
+template <bool PowerOfTwo>
+double measure_throughput(size_t ring_size, uint64_t messages)
+{
+  lockfree_spsc<uint64_t, PowerOfTwo> q(ring_size);
+
+  const auto start = benchmark_clock::now();
+
+  std::jthread producer(
+      [&q, messages]
+      {
+        for (uint64_t i = 0; i < messages; ++i)
+        {
+          while (!q.try_push(uint64_t{i}))
+          {
+          }
+        }
+      });
+
+  uint64_t checksum{};
+  for (uint64_t popped_num = 0; popped_num != messages;)
+  {
+    uint64_t popped{};
+    if (q.try_pop(popped))
+    {
+      checksum += popped;
+      ++popped_num;
+    }
+  }
+  producer.join();
+
+  const std::chrono::duration<double> elapsed = benchmark_clock::now() - start;
+
+  if (checksum != messages * (messages - 1) / 2)
+  {
+    fmt::print(stderr, "Corrupted stream, checksum {}\n", checksum);
+    std::exit(EXIT_FAILURE);
+  }
+
+  return static_cast<double>(messages) / elapsed.count();
+}
+
+/**
+ * @brief Bounces a message back and forth over two queues "round_trips" times
+ * and returns the average round trip in nanoseconds.
+ */
+double measure_round_trip(uint64_t round_trips)
+{
+  lockfree_spsc<uint64_t> ping(1);
+  lockfree_spsc<uint64_t> pong(1);
+
+  std::jthread echo(
+      [&ping, &pong, round_trips]
+      {
+        for (uint64_t i = 0; i < round_trips; ++i)
+        {
+          uint64_t msg{};
+          while (!ping.try_pop(msg))
+          {
+          }
+          while (!pong.try_push(std::move(msg)))
+          {
+          }
+        }
+      });
+
+  const auto start = benchmark_clock::now();
+  for (uint64_t i = 0; i < round_trips; ++i)
+  {
+    while (!ping.try_push(uint64_t{i}))
+    {
+    }
+    uint64_t msg{};
+    while (!pong.try_pop(msg))
+    {
+    }
+  }
+  const std::chrono::duration<double, std::nano> elapsed = benchmark_clock::now() - start;
+
+  return elapsed.count() / static_cast<double>(round_trips);
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+  const uint64_t messages = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10'000'000;
+  const uint64_t round_trips = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 100'000;
+
+  for (const size_t ring_size : {16, 1024, 65536})
+  {
+    fmt::print("ring size {:>6}: {:8.2f} Mmsg/s, power of two {:8.2f} Mmsg/s\n",
+               ring_size,
+               measure_throughput<false>(ring_size, messages) / 1e6,
+               measure_throughput<true>(ring_size, messages) / 1e6);
+  }
+
+  fmt::print("round trip: {:.1f} ns\n", measure_round_trip(round_trips));
+
+  return 0;
+}
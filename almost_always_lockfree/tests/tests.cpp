@@ -1,8 +1,14 @@
+#include <array>
 #include <chrono>
+#include <memory>
+#include <numeric>
 #include <queue>
+#include <stdexcept>
 #include <thread>
+#include <vector>
 
 #include "almost_always_lockfree_queue.h"
+#include "lockfree_spsc.h"
 #include "gtest/gtest.h"
 
 namespace
@@ -12,6 +18,82 @@ namespace
  */
 inline bool is_multiple_of(size_t num, size_t factor) noexcept { return (num % factor) == 0; }
 
+/**
+ * @brief Neither default constructible nor movable, and counts how many
+ * instances are alive.
+ */
+struct pinned_counter
+{
+  pinned_counter(int value_, int& alive_) : value(value_), alive(alive_) { ++alive; }
+  pinned_counter(const pinned_counter&) = delete;
+  pinned_counter& operator=(const pinned_counter&) = delete;
+  ~pinned_counter() { --alive; }
+
+  int value;
+  int& alive;
+};
+
+/**
+ * @brief Counts how many instances are alive, and throws when moved from an
+ * instance holding throw_on_move.
+ */
+struct throwing_counter
+{
+  static constexpr int throw_on_move = -1;
+
+  throwing_counter(int value_, int& alive_) : value(value_), alive(&alive_) { ++*alive; }
+  throwing_counter(throwing_counter&& other_) : value(other_.value), alive(other_.alive)
+  {
+    if (value == throw_on_move)
+    {
+      throw std::runtime_error("move");
+    }
+    ++*alive;
+  }
+  throwing_counter& operator=(throwing_counter&&) = default;
+  ~throwing_counter() { --*alive; }
+
+  int value;
+  int* alive;
+};
+
+/**
+ * @brief Pushes and pops runs of elements through a queue that can hold 8 of
+ * them, going around the ring several times.
+ */
+template <bool PowerOfTwo>
+void check_bulk_push_pop()
+{
+  lockfree_spsc<int, PowerOfTwo> q(8);
+  ASSERT_EQ(8u, q.capacity());
+
+  int next_pushed{};
+  int next_popped{};
+  for (int lap = 0; lap < 5; ++lap)
+  {
+    std::vector<int> batch(5);
+    std::iota(batch.begin(), batch.end(), next_pushed);
+    EXPECT_EQ(5u, q.try_push_n(batch.begin(), batch.end()));
+    next_pushed += 5;
+
+    // Only some of the second batch fits
+    std::iota(batch.begin(), batch.end(), next_pushed);
+    EXPECT_EQ(3u, q.try_push_n(batch.begin(), batch.end()));
+    next_pushed += 3;
+
+    std::vector<int> popped;
+    EXPECT_EQ(6u, q.try_pop_n(std::back_inserter(popped), 6));
+    EXPECT_EQ(2u, q.try_pop_n(std::back_inserter(popped), 6));
+    EXPECT_EQ(0u, q.try_pop_n(std::back_inserter(popped), 6));
+
+    ASSERT_EQ(8u, popped.size());
+    for (const int p : popped)
+    {
+      EXPECT_EQ(next_popped++, p);
+    }
+  }
+}
+
 } // namespace
 
 TEST(almost_always_lockfree_queue, push_and_pop)
@@ -76,6 +158,90 @@ TEST(almost_always_lockfree_queue, push_all_pop_exension_push_again)
   }
 }
 
+TEST(almost_always_lockfree_queue, repeated_bursts_of_move_only_items)
+{
+  const size_t lockfree_size = 4;
+  almost_always_lockfree_queue<std::unique_ptr<int>> q(lockfree_size, 2);
+
+  // Each burst spills over into several segments, which get recycled (or
+  // freed when the pool is full) as they are drained.
+  for (int burst = 0; burst < 5; ++burst)
+  {
+    const int burst_size = static_cast<int>(lockfree_size) * (burst + 1) + 1;
+    for (int i = 0; i < burst_size; ++i)
+    {
+      q.push(std::make_unique<int>(i));
+    }
+
+    for (int i = 0; i < burst_size; ++i)
+    {
+      std::unique_ptr<int> popped;
+      ASSERT_TRUE(q.try_pop(popped));
+      ASSERT_TRUE(popped);
+      EXPECT_EQ(i, *popped);
+    }
+
+    std::unique_ptr<int> _;
+    EXPECT_FALSE(q.try_pop(_));
+  }
+
+  // Leave something behind for the destructor to clean up
+  q.push(std::make_unique<int>(42));
+}
+
+TEST(almost_always_lockfree_queue, batched_pop_across_segments)
+{
+  const size_t lockfree_size = 4;
+  almost_always_lockfree_queue<int> q(lockfree_size);
+
+  for (int i = 0; i < 10; ++i)
+  {
+    q.push(int{i});
+  }
+
+  // Spans the first two segments and stops in the middle of the third
+  std::array<int, 9> popped{};
+  EXPECT_EQ(popped.size(), q.try_pop_n(popped.begin(), popped.size()));
+  for (int i = 0; i < static_cast<int>(popped.size()); ++i)
+  {
+    EXPECT_EQ(i, popped[i]);
+  }
+
+  q.push(10);
+
+  std::vector<int> rest;
+  EXPECT_EQ(2u, q.try_pop_n(std::back_inserter(rest), 100));
+  EXPECT_EQ((std::vector<int>{9, 10}), rest);
+  EXPECT_EQ(0u, q.try_pop_n(std::back_inserter(rest), 100));
+}
+
+TEST(almost_always_lockfree_queue, concurrent_push_batched_pop)
+{
+  const size_t lockfree_size = 1000;
+  const int total_elems = 1000000;
+  almost_always_lockfree_queue<int> q(lockfree_size);
+
+  std::jthread t(
+      [total_elems, &q]
+      {
+        for (int i = 0; i < total_elems; ++i)
+        {
+          q.push(int{i});
+        }
+      });
+
+  std::vector<int> popped;
+  while (popped.size() != total_elems)
+  {
+    q.try_pop_n(std::back_inserter(popped), 256);
+  }
+
+  for (int i = 0; i < total_elems; ++i)
+  {
+    ASSERT_EQ(i, popped[i]);
+  }
+}
+
 TEST(almost_always_lockfree_queue, concurrent_push_pop)
 {
   const size_t lockfree_size = 10000;
@@ -162,3 +328,209 @@ TEST(almost_always_lockfree_queue, concurrent_push_pop_slow_reader)
     }
   }
 }
+
+TEST(lockfree_spsc, fill_and_drain)
+{
+  const size_t ring_size = 5;
+  lockfree_spsc<int> q(ring_size);
+
+  // Go around the ring a few times so that both cached indices get refreshed
+  // on the full and on the empty side.
+  for (int lap = 0; lap < 3; ++lap)
+  {
+    for (size_t i = 0; i < ring_size; ++i)
+    {
+      EXPECT_TRUE(q.try_push(static_cast<int>(i)));
+    }
+    EXPECT_FALSE(q.try_push(-1));
+
+    for (size_t i = 0; i < ring_size; ++i)
+    {
+      int popped{};
+      EXPECT_TRUE(q.try_pop(popped));
+      EXPECT_EQ(static_cast<int>(i), popped);
+    }
+
+    int _{};
+    EXPECT_FALSE(q.try_pop(_));
+  }
+}
+
+TEST(lockfree_spsc, concurrent_push_pop)
+{
+  const size_t total_elems = 100000;
+  lockfree_spsc<int> q(1000);
+
+  std::jthread t(
+      [total_elems, &q]
+      {
+        for (size_t i = 0; i < total_elems; ++i)
+        {
+          while (!q.try_push(static_cast<int>(i)))
+          {
+          }
+        }
+      });
+
+  for (size_t popped_num = 0; popped_num != total_elems;)
+  {
+    int popped{};
+    if (q.try_pop(popped))
+    {
+      EXPECT_EQ(static_cast<int>(popped_num), popped);
+      popped_num++;
+    }
+  }
+}
+
+TEST(lockfree_spsc, power_of_two_uses_every_slot)
+{
+  lockfree_spsc<int, true> q(5);
+  ASSERT_EQ(8u, q.capacity());
+
+  for (int lap = 0; lap < 3; ++lap)
+  {
+    for (int i = 0; i < 8; ++i)
+    {
+      EXPECT_TRUE(q.try_push(lap * 8 + i));
+    }
+    EXPECT_FALSE(q.try_push(-1));
+
+    for (int i = 0; i < 8; ++i)
+    {
+      int popped{};
+      EXPECT_TRUE(q.try_pop(popped));
+      EXPECT_EQ(lap * 8 + i, popped);
+    }
+
+    int _{};
+    EXPECT_FALSE(q.try_pop(_));
+  }
+}
+
+TEST(lockfree_spsc, power_of_two_concurrent_push_pop)
+{
+  const size_t total_elems = 100000;
+  lockfree_spsc<int, true> q(1024);
+
+  std::jthread t(
+      [total_elems, &q]
+      {
+        for (size_t i = 0; i < total_elems; ++i)
+        {
+          while (!q.try_push(static_cast<int>(i)))
+          {
+          }
+        }
+      });
+
+  for (size_t popped_num = 0; popped_num != total_elems;)
+  {
+    int popped{};
+    if (q.try_pop(popped))
+    {
+      EXPECT_EQ(static_cast<int>(popped_num), popped);
+      popped_num++;
+    }
+  }
+}
+
+TEST(lockfree_spsc, emplace_front_and_pop)
+{
+  int alive{};
+  {
+    lockfree_spsc<pinned_counter> q(3);
+    EXPECT_EQ(nullptr, q.front());
+
+    for (int i = 0; i < 3; ++i)
+    {
+      EXPECT_TRUE(q.try_emplace(i, alive));
+    }
+    EXPECT_FALSE(q.try_emplace(-1, alive));
+    EXPECT_EQ(3, alive);
+
+    const pinned_counter* first = q.front();
+    ASSERT_NE(nullptr, first);
+    EXPECT_EQ(0, first->value);
+    // Peeking twice gives back the same element
+    EXPECT_EQ(first, q.front());
+
+    q.pop();
+    EXPECT_EQ(2, alive);
+    ASSERT_NE(nullptr, q.front());
+    EXPECT_EQ(1, q.front()->value);
+  }
+  // Whatever was left in the queue gets destroyed with it
+  EXPECT_EQ(0, alive);
+}
+
+TEST(lockfree_spsc, bulk_push_pop) { check_bulk_push_pop<false>(); }
+
+TEST(lockfree_spsc, power_of_two_bulk_push_pop) { check_bulk_push_pop<true>(); }
+
+TEST(lockfree_spsc, concurrent_bulk_push_pop)
+{
+  const int total_elems = 100000;
+  lockfree_spsc<int, true> q(1024);
+
+  std::jthread t(
+      [total_elems, &q]
+      {
+        std::vector<int> batch(100);
+        for (int i = 0; i < total_elems; i += batch.size())
+        {
+          std::iota(batch.begin(), batch.end(), i);
+          for (auto first = batch.begin(); first != batch.end();)
+          {
+            first += q.try_push_n(first, batch.end());
+          }
+        }
+      });
+
+  int expected{};
+  while (expected != total_elems)
+  {
+    q.consume_n([&expected](int& popped) { EXPECT_EQ(expected++, popped); }, 64);
+  }
+}
+
+TEST(lockfree_spsc, bulk_push_pop_throwing_halfway)
+{
+  int alive{};
+  {
+    lockfree_spsc<throwing_counter> q(8);
+
+    std::vector<throwing_counter> batch;
+    for (const int value : {0, 1, throwing_counter::throw_on_move, 3})
+    {
+      batch.emplace_back(value, alive);
+    }
+    ASSERT_EQ(4, alive);
+
+    // The two moved before the throw are in the queue, and only those
+    EXPECT_THROW(q.try_push_n(batch.begin(), batch.end()), std::runtime_error);
+    EXPECT_EQ(6, alive);
+    batch.clear();
+    EXPECT_EQ(2, alive);
+
+    const auto fail_on_second = [](throwing_counter& c_)
+    {
+      if (c_.value == 1)
+      {
+        throw std::runtime_error("consume");
+      }
+    };
+    // The first is released, the one it threw on stays for the next call
+    EXPECT_THROW(q.consume_n(fail_on_second, 8), std::runtime_error);
+    EXPECT_EQ(1, alive);
+    ASSERT_NE(nullptr, q.front());
+    EXPECT_EQ(1, q.front()->value);
+
+    std::vector<int> values;
+    EXPECT_EQ(1u, q.consume_n([&values](throwing_counter& c_) { values.push_back(c_.value); }, 8));
+    EXPECT_EQ((std::vector<int>{1}), values);
+    EXPECT_EQ(0, alive);
+    EXPECT_EQ(nullptr, q.front());
+  }
+  EXPECT_EQ(0, alive);
+}
@@ -1,12 +1,20 @@
 #pragma once
 #include "lockfree_spsc.h"
-#include <deque>
-#include <mutex>
+#include <atomic>
+#include <cassert>
+#include <utility>
 
 /**
  * @brief This class will use a lockfree queue until a certain size, then it
- * will start using a locked queue. This is useful when we want the speed of
- * a lockfree queue, but we cannot put a hard limit on the size.
+ * will chain more lockfree queues of the same size after it. This is useful
+ * when we want the speed of a lockfree queue, but we cannot put a hard limit
+ * on the size.
+ *
+ * The producer only ever writes into the last segment of the chain and the
+ * consumer only ever reads from the first one, so FIFO order is preserved
+ * across segments. Drained segments are handed back to the producer through a
+ * small lockfree pool, so a queue that keeps going through bursts of similar
+ * size stops allocating after the first one.
  *
  * @tparam T
  */
@@ -14,58 +22,154 @@ template <typename T>
 class almost_always_lockfree_queue
 {
 public:
-  explicit almost_always_lockfree_queue(size_t lockfree_size)
-      : _base_queue(lockfree_size)
+  explicit almost_always_lockfree_queue(size_t lockfree_size,
+                                        size_t max_pooled_segments = 4)
+      : _segment_size(lockfree_size),
+        _head(new segment(lockfree_size)),
+        _tail(_head),
+        _pool(max_pooled_segments)
   {
   }
 
-  void push(T&& item)
+  almost_always_lockfree_queue(const almost_always_lockfree_queue&) = delete;
+  almost_always_lockfree_queue(almost_always_lockfree_queue&&) = delete;
+
+  ~almost_always_lockfree_queue()
   {
-    const bool using_extension =
-        _extension_size.load(std::memory_order_acquire);
+    while (_head)
+    {
+      delete std::exchange(_head, _head->next.load(std::memory_order_relaxed));
+    }
+
+    segment* pooled{};
+    while (_pool.try_pop(pooled))
+    {
+      delete pooled;
+    }
+  }
 
-    // If we are not using the extension then try to push in the lockfree queue.
-    if (!using_extension && _base_queue.try_push(std::forward<T>(item)))
+  void push(T&& item)
+  {
+    // The common case: there is room in the segment we are writing to.
+    if (_tail->queue.try_push(std::forward<T>(item)))
     {
       return;
     }
 
-    // We are either using the extension or we failed to push in the lockfree
-    // queue. Time to push into the extension
-    std::lock_guard l(_m);
-    _extension.push_back(std::forward<T>(item));
-    _extension_size.fetch_add(1, std::memory_order_release);
+    // It's full, move on to a new segment. try_push does not touch the item
+    // when it fails, so it is still ours to push.
+    segment* const next = acquire_segment();
+    [[maybe_unused]] const bool pushed =
+        next->queue.try_push(std::forward<T>(item));
+    assert(pushed);
 
-    return;
+    // Publishing the link also publishes the element we just pushed.
+    _tail->next.store(next, std::memory_order_release);
+    _tail = next;
   }
 
   bool try_pop(T& popped)
   {
-    // Try to pop from the lockfree queue, that's what gets filled first
-    if (_base_queue.try_pop(popped))
+    while (true)
     {
-      return true;
+      if (_head->queue.try_pop(popped))
+      {
+        return true;
+      }
+
+      segment* const next = _head->next.load(std::memory_order_acquire);
+      if (!next)
+      {
+        return false;
+      }
+
+      // The producer has moved on, but it might have pushed a last element
+      // between our try_pop and linking the next segment. Now that we have
+      // seen the link we are guaranteed to see that element too.
+      if (_head->queue.try_pop(popped))
+      {
+        return true;
+      }
+
+      release_segment(std::exchange(_head, next));
     }
+  }
 
-    // Failed to pop from the lockfree, try the extension.
-    const bool using_extension =
-        _extension_size.load(std::memory_order_acquire);
+  /**
+   * @brief Moves up to max_popped elements into out, oldest first, releasing
+   * each segment's slots with a single store. Returns how many were popped.
+   */
+  template <typename OutputIt>
+  size_t try_pop_n(OutputIt out, size_t max_popped)
+  {
+    const auto move_out = [&out](T& item) { *out++ = std::move(item); };
 
-    if (using_extension)
+    size_t popped{};
+    while (popped != max_popped)
     {
-      std::lock_guard l(_m);
-      popped = _extension.front();
-      _extension.pop_front();
-      _extension_size.fetch_sub(1, std::memory_order_release);
-      return true;
+      popped += _head->queue.consume_n(move_out, max_popped - popped);
+      if (popped == max_popped)
+      {
+        break;
+      }
+
+      segment* const next = _head->next.load(std::memory_order_acquire);
+      if (!next)
+      {
+        break;
+      }
+
+      // Same as in try_pop, pick up what was pushed before the link.
+      popped += _head->queue.consume_n(move_out, max_popped - popped);
+      if (popped == max_popped)
+      {
+        break;
+      }
+
+      release_segment(std::exchange(_head, next));
     }
 
-    return false;
+    return popped;
   }
 
 private:
-  lockfree_spsc<T> _base_queue;
-  std::deque<T> _extension;
-  std::atomic_int _extension_size{};
-  std::mutex _m;
-};
\ No newline at end of file
+  struct segment
+  {
+    explicit segment(size_t size) : queue(size) {}
+
+    lockfree_spsc<T> queue;
+    std::atomic<segment*> next{};
+  };
+
+  segment* acquire_segment()
+  {
+    segment* recycled{};
+    if (_pool.try_pop(recycled))
+    {
+      return recycled;
+    }
+
+    return new segment(_segment_size);
+  }
+
+  void release_segment(segment* drained)
+  {
+    drained->next.store(nullptr, std::memory_order_relaxed);
+    if (!_pool.try_push(std::move(drained)))
+    {
+      // The pool is full, we have been through an unusually large burst.
+      delete drained;
+    }
+  }
+
+  const size_t _segment_size;
+
+  // Only touched by the consumer
+  alignas(hardware_destructive_interference_size) segment* _head;
+
+  // Only touched by the producer
+  alignas(hardware_destructive_interference_size) segment* _tail;
+
+  // Drained segments going from the consumer back to the producer.
+  lockfree_spsc<segment*> _pool;
+};
@@ -1,10 +1,16 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
+#include <iterator>
+#include <memory>
 #include <new>
 #include <type_traits>
-#include <vector>
 
 #ifdef __cpp_lib_hardware_interference_size
 using std::hardware_destructive_interference_size;
@@ -17,68 +23,205 @@ constexpr std::size_t hardware_destructive_interference_size = 64;
 #define CACHE_LINE_SIZE 128
 
 // A simplified version of folly::ProducerConsumerQueue
-template <typename T>
+//
+// With PowerOfTwo set the capacity is rounded up to a power of two and the
+// indices become free-running counters that are masked on access: no slot is
+// wasted and there is no wrap-around branch on either side.
+template <typename T, bool PowerOfTwo = false>
 class lockfree_spsc
 {
 public:
   explicit lockfree_spsc(size_t ring_size_)
-      : _next_read_idx(0),
-        _next_write_idx(0),
-        _ring(ring_size_ + 1) // one is wasted.
+      : _storage_size(ring_storage_size(ring_size_)),
+        _ring(std::make_unique_for_overwrite<slot_storage[]>(_storage_size)),
+        _mask(_storage_size - 1),
+        _next_read_idx(0),
+        _next_write_idx(0)
   {
-    // TODO: Use concepts instead
-    static_assert(std::is_move_assignable_v<T> &&
-                  std::is_move_constructible_v<T>);
   }
 
   lockfree_spsc(const lockfree_spsc&) = delete;
   lockfree_spsc(lockfree_spsc&&) = delete;
 
+  ~lockfree_spsc()
+  {
+    while (front())
+    {
+      pop();
+    }
+  }
+
+  /**
+   * @brief The number of elements the queue can hold.
+   */
+  size_t capacity() const noexcept
+  {
+    return PowerOfTwo ? _storage_size : _storage_size - 1;
+  }
+
   bool try_push(T&& t_)
+    requires std::is_move_constructible_v<T>
+  {
+    return try_emplace(std::move(t_));
+  }
+
+  /**
+   * @brief Constructs the element directly in the ring from args_. Returns
+   * false (and constructs nothing) if the queue is full.
+   */
+  template <typename... Args>
+  bool try_emplace(Args&&... args_)
   {
-    const int cur_writer_idx = _next_write_idx.load(std::memory_order_relaxed);
-    const int cur_reader_idx = _next_read_idx.load(std::memory_order_acquire);
+    const uint64_t cur_writer_idx =
+        _next_write_idx.load(std::memory_order_relaxed);
+    const uint64_t new_writer_idx = next_index(cur_writer_idx);
 
-    int new_writer_idx = cur_writer_idx + 1;
-    if (new_writer_idx == static_cast<int>(_ring.size()))
+    // Only go and fetch the reader's index (and its cache line) if our last
+    // copy of it says we are full: it can only have moved forward since.
+    if (is_full(new_writer_idx))
     {
-      new_writer_idx = 0;
+      _cached_read_idx = _next_read_idx.load(std::memory_order_acquire);
+      if (is_full(new_writer_idx))
+      {
+        return false;
+      }
     }
 
-    if (new_writer_idx == cur_reader_idx)
+    new (_ring[slot(cur_writer_idx)].data) T(std::forward<Args>(args_)...);
+    _next_write_idx.store(new_writer_idx, std::memory_order_release);
+
+    return true;
+  }
+
+  /**
+   * @brief Moves as many elements of [first_, last_) as fit into the queue and
+   * publishes them all at once. Returns how many were pushed. If a move
+   * throws, the elements moved before it are still published.
+   */
+  template <std::forward_iterator It>
+  size_t try_push_n(It first_, It last_)
+  {
+    const uint64_t cur_writer_idx =
+        _next_write_idx.load(std::memory_order_relaxed);
+    const size_t wanted = static_cast<size_t>(std::distance(first_, last_));
+
+    size_t n = free_slots(cur_writer_idx);
+    if (n < wanted)
     {
-      return false;
+      _cached_read_idx = _next_read_idx.load(std::memory_order_acquire);
+      n = free_slots(cur_writer_idx);
     }
-    else
-    {
-      _ring[cur_writer_idx] = std::move(t_);
-      _next_write_idx.store(new_writer_idx, std::memory_order_release);
+    n = std::min(n, wanted);
 
-      return true;
+    uint64_t idx = cur_writer_idx;
+    {
+      const publish_on_exit publish{_next_write_idx, idx};
+      for (size_t i = 0; i < n; ++i, ++first_)
+      {
+        new (_ring[slot(idx)].data) T(std::move(*first_));
+        idx = next_index(idx);
+      }
     }
+
+    return n;
   }
 
   bool try_pop(T& t_)
+    requires std::is_move_assignable_v<T>
   {
-    const int cur_reader_idx = _next_read_idx.load(std::memory_order_relaxed);
-    const int cur_writer_idx = _next_write_idx.load(std::memory_order_acquire);
-
-    if (cur_reader_idx == cur_writer_idx)
+    T* const next = front();
+    if (!next)
     {
       return false;
     }
 
-    int new_reader_idx = cur_reader_idx + 1;
-    if (new_reader_idx == static_cast<int>(_ring.size()))
+    // Got something to read
+    t_ = std::move(*next);
+    pop();
+
+    return true;
+  }
+
+  /**
+   * @brief Moves up to max_ elements into out_ and releases their slots all
+   * at once. Returns how many were popped.
+   */
+  template <typename OutputIt>
+  size_t try_pop_n(OutputIt out_, size_t max_)
+  {
+    return consume_n([&out_](T& t_) { *out_++ = std::move(t_); }, max_);
+  }
+
+  /**
+   * @brief Calls f_ on up to max_ elements in place, oldest first, then
+   * destroys them and releases their slots all at once. Returns how many were
+   * consumed. If f_ throws, the element it threw on stays in the queue and the
+   * ones before it are released.
+   */
+  template <typename F>
+  size_t consume_n(F&& f_, size_t max_)
+  {
+    const uint64_t cur_reader_idx =
+        _next_read_idx.load(std::memory_order_relaxed);
+
+    size_t n = readable_slots(cur_reader_idx);
+    if (n < max_)
+    {
+      _cached_write_idx = _next_write_idx.load(std::memory_order_acquire);
+      n = readable_slots(cur_reader_idx);
+    }
+    n = std::min(n, max_);
+
+    uint64_t idx = cur_reader_idx;
     {
-      new_reader_idx = 0;
+      const publish_on_exit publish{_next_read_idx, idx};
+      for (size_t i = 0; i < n; ++i)
+      {
+        T* const t = element(idx);
+        f_(*t);
+        t->~T();
+        idx = next_index(idx);
+      }
     }
 
-    // Got something to read
-    t_ = std::move(_ring[cur_reader_idx]);
-    _next_read_idx.store(new_reader_idx, std::memory_order_release);
+    return n;
+  }
 
-    return true;
+  /**
+   * @brief Returns the oldest element in place, or nullptr if the queue is
+   * empty. It stays valid until pop() is called.
+   */
+  T* front()
+  {
+    const uint64_t cur_reader_idx =
+        _next_read_idx.load(std::memory_order_relaxed);
+
+    // Same as in try_emplace, only look at the writer's index if we think we
+    // are empty.
+    if (cur_reader_idx == _cached_write_idx)
+    {
+      _cached_write_idx = _next_write_idx.load(std::memory_order_acquire);
+      if (cur_reader_idx == _cached_write_idx)
+      {
+        return nullptr;
+      }
+    }
+
+    return element(cur_reader_idx);
+  }
+
+  /**
+   * @brief Destroys the element returned by front() and hands its slot back
+   * to the producer. The queue must not be empty.
+   */
+  void pop()
+  {
+    const uint64_t cur_reader_idx =
+        _next_read_idx.load(std::memory_order_relaxed);
+    assert(cur_reader_idx != _cached_write_idx);
+
+    element(cur_reader_idx)->~T();
+    _next_read_idx.store(next_index(cur_reader_idx), std::memory_order_release);
   }
 
   void print()
@@ -86,17 +229,139 @@ public:
     std::cout << "Ring "
               << ", cur r " << _next_read_idx << ", cur w " << _next_write_idx
               << std::endl;
-    for (size_t i = 0; i < _ring.size(); ++i)
+    const uint64_t end_idx = _next_write_idx.load(std::memory_order_acquire);
+    for (uint64_t i = _next_read_idx; i != end_idx; i = next_index(i))
     {
-      std::cout << _ring[i] << std::endl;
+      std::cout << *element(i) << std::endl;
     }
   }
 
 private:
+  struct slot_storage
+  {
+    alignas(T) std::byte data[sizeof(T)];
+  };
+
+  /**
+   * @brief Publishes idx into index when it goes out of scope, exception or
+   * not, so that a bulk operation that throws halfway still hands over the
+   * slots it is done with, and only those.
+   */
+  struct publish_on_exit
+  {
+    ~publish_on_exit() { index.store(idx, std::memory_order_release); }
+
+    std::atomic_uint64_t& index;
+    const uint64_t& idx;
+  };
+
+  // Read by both sides on every access but never written after construction,
+  // so they go on a line of their own that both can keep cached.
+  alignas(hardware_destructive_interference_size) const size_t _storage_size;
+  // Slots are only constructed between the read and the write index.
+  std::unique_ptr<slot_storage[]> _ring;
+  const uint64_t _mask;
+
+  // Each side keeps its own index and its copy of the other side's index on
+  // its own cache line, so the lines only travel when a copy is refreshed.
   alignas(hardware_destructive_interference_size) std::atomic_uint64_t
       _next_read_idx{};
+  uint64_t _cached_write_idx{};
   alignas(hardware_destructive_interference_size) std::atomic_uint64_t
       _next_write_idx{};
+  uint64_t _cached_read_idx{};
+
+  T* element(uint64_t idx_) const noexcept
+  {
+    return std::launder(reinterpret_cast<T*>(_ring[slot(idx_)].data));
+  }
+
+  /**
+   * @brief How many slots the producer can fill according to its cached copy
+   * of the reader's index.
+   */
+  size_t free_slots(uint64_t cur_writer_idx_) const noexcept
+  {
+    if constexpr (PowerOfTwo)
+    {
+      return _storage_size - (cur_writer_idx_ - _cached_read_idx);
+    }
+    else
+    {
+      return _cached_read_idx > cur_writer_idx_
+                 ? _cached_read_idx - cur_writer_idx_ - 1
+                 : _storage_size - (cur_writer_idx_ - _cached_read_idx) - 1;
+    }
+  }
+
+  /**
+   * @brief How many elements the consumer can read according to its cached
+   * copy of the writer's index.
+   */
+  size_t readable_slots(uint64_t cur_reader_idx_) const noexcept
+  {
+    if constexpr (PowerOfTwo)
+    {
+      return _cached_write_idx - cur_reader_idx_;
+    }
+    else
+    {
+      return _cached_write_idx >= cur_reader_idx_
+                 ? _cached_write_idx - cur_reader_idx_
+                 : _storage_size - (cur_reader_idx_ - _cached_write_idx);
+    }
+  }
+
+  static size_t ring_storage_size(size_t ring_size_)
+  {
+    if constexpr (PowerOfTwo)
+    {
+      return std::bit_ceil(ring_size_);
+    }
+    else
+    {
+      return ring_size_ + 1; // one is wasted.
+    }
+  }
+
+  /**
+   * @brief The index following idx_: the next counter value for the power of
+   * two ring, the next slot (wrapping around) otherwise.
+   */
+  uint64_t next_index(uint64_t idx_) const noexcept
+  {
+    if constexpr (PowerOfTwo)
+    {
+      return idx_ + 1;
+    }
+    else
+    {
+      const uint64_t next = idx_ + 1;
+      return next == _storage_size ? 0 : next;
+    }
+  }
+
+  size_t slot(uint64_t idx_) const noexcept
+  {
+    if constexpr (PowerOfTwo)
+    {
+      return idx_ & _mask;
+    }
+    else
+    {
+      return idx_;
+    }
+  }
 
-  std::vector<T> _ring;
+  bool is_full(uint64_t new_writer_idx_) const noexcept
+  {
+    if constexpr (PowerOfTwo)
+    {
+      return new_writer_idx_ - _cached_read_idx > _storage_size;
+    }
+    else
+    {
+      return new_writer_idx_ == _cached_read_idx;
+    }
+  }
 };
@@ -0,0 +1,294 @@
+#pragma once
+
+#include <asio/ip/udp.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <system_error>
+#include <utility>
+
+#if defined(__linux__)
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+#include "InputBuffer.h"
+
+/**
+ * @brief Sends and receives InputBuffers in batches, with one sendmmsg or
+ * recvmmsg per batch instead of one syscall per datagram. Where those are not
+ * available it falls back to one syscall per datagram behind the same
+ * interface.
+ *
+ * With enable_offload() the kernel also does the splitting into datagrams
+ * (UDP GSO) and the coalescing of what arrives (UDP GRO): each message then
+ * carries up to MaxSegments InputBuffers, laid out back to back, and each of
+ * them still travels as a datagram of its own, with its own header. The kernel
+ * only segments into datagrams that fit the path MTU without fragmenting, and
+ * an InputBuffer plus the UDP and IP headers is more than a standard 1500
+ * byte link takes. So GSO only pays off over loopback or jumbo frames, and
+ * when the kernel refuses a send the socket goes back to one datagram per
+ * message for good.
+ *
+ * It also counts the syscalls it makes, for the stats: the ones that moved
+ * datagrams apart from the reads that found nothing, so that the datagrams per
+ * syscall are not diluted by polling.
+ */
+class BatchedSocket
+{
+public:
+  // Messages per sendmmsg or recvmmsg
+  constexpr static size_t MaxBatch = 64;
+
+  // The most InputBuffers that fit in a 64KB UDP datagram, with offload on
+  constexpr static size_t MaxSegments = 65507 / InputBuffer::MTU;
+
+  // Enough buffers to pass to receive() for a few messages even with offload
+  constexpr static size_t BatchBuffers = 4 * MaxSegments;
+
+  struct Stats
+  {
+    // Only the syscalls that moved at least one datagram
+    int64_t syscalls{};
+    int64_t empty_reads{};
+    int64_t datagrams{};
+    int64_t bytes{};
+  };
+
+  explicit BatchedSocket(::asio::ip::udp::socket& socket_) : _socket(socket_)
+  {
+    // Segments are cut at fixed offsets, so a part must be exactly that long.
+    static_assert(sizeof(InputBuffer) == InputBuffer::MTU);
+  }
+
+  /**
+   * @brief Turns on UDP GSO and GRO for the socket, for the sender and the
+   * receiver alike. Needs Linux 5.0 or later; loopback supports both. GSO can
+   * still be turned off again by the first send, see segmenting().
+   * @return false, with the reason in err_, if the kernel does not support it
+   */
+  bool enable_offload(std::error_code& err_)
+  {
+#if defined(__linux__)
+    const int segment_size = InputBuffer::MTU;
+    const int on = 1;
+    if (::setsockopt(_socket.native_handle(),
+                     IPPROTO_UDP,
+                     UDP_SEGMENT,
+                     &segment_size,
+                     sizeof(segment_size)) != 0 ||
+        ::setsockopt(_socket.native_handle(), IPPROTO_UDP, UDP_GRO, &on, sizeof(on)) != 0)
+    {
+      err_ = std::error_code(errno, std::system_category());
+      return false;
+    }
+    _offload = true;
+    _segmenting = true;
+    return true;
+#else
+    err_ = std::make_error_code(std::errc::not_supported);
+    return false;
+#endif
+  }
+
+  /**
+   * @brief Whether sends are still handed to the kernel to segment. Turns
+   * false after enable_offload() if the path MTU is too small for a segment.
+   */
+  bool segmenting() const { return _segmenting; }
+
+  /**
+   * @brief Whether the last receive() filled every message it asked for, so
+   * there are probably more datagrams waiting.
+   */
+  bool more_waiting() const { return _more_waiting; }
+
+  /**
+   * @brief Sends the count_ buffers to endpoint_, MaxBatch at a time. Stops at
+   * the first error, which is reported in err_.
+   * @return the number of bytes sent
+   */
+  size_t send_to(const InputBuffer* buffers_,
+                 size_t count_,
+                 const ::asio::ip::udp::endpoint& endpoint_,
+                 std::error_code& err_)
+  {
+    size_t sent_bytes = 0;
+#if defined(__linux__)
+    std::array<iovec, MaxBatch> iovecs;
+    std::array<mmsghdr, MaxBatch> msgs;
+
+    size_t sent = 0;
+    while (sent < count_)
+    {
+      // With GSO a message is a run of consecutive buffers, which the kernel
+      // cuts back into one datagram each.
+      const size_t per_message = _segmenting ? MaxSegments : 1;
+
+      size_t batch = 0;
+      for (size_t next = sent; batch < MaxBatch && next < count_; ++batch)
+      {
+        const size_t i = batch;
+        const size_t segments = std::min(per_message, count_ - next);
+        iovecs[i] = iovec{const_cast<InputBuffer*>(buffers_ + next), segments * InputBuffer::MTU};
+        next += segments;
+
+        msgs[i] = mmsghdr{};
+        msgs[i].msg_hdr.msg_name = const_cast<sockaddr*>(endpoint_.data());
+        msgs[i].msg_hdr.msg_namelen = static_cast<socklen_t>(endpoint_.size());
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+      }
+
+      const int n = ::sendmmsg(
+          _socket.native_handle(), msgs.data(), static_cast<unsigned>(batch), 0);
+      if (n < 0)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        // The segments do not fit the path MTU. Nothing of this batch went
+        // out, so send it again one datagram per message, which the kernel
+        // fragments like any other.
+        if (_segmenting && (errno == EMSGSIZE || errno == EINVAL) && stop_segmenting())
+        {
+          continue;
+        }
+        err_ = std::error_code(errno, std::system_category());
+        break;
+      }
+
+      _stats.syscalls++;
+      for (int i = 0; i < n; ++i)
+      {
+        sent_bytes += msgs[i].msg_len;
+        const size_t segments = iovecs[i].iov_len / InputBuffer::MTU;
+        sent += segments;
+        _stats.datagrams += segments;
+      }
+    }
+#else
+    for (size_t i = 0; i < count_ && !err_; ++i)
+    {
+      sent_bytes += _socket.send_to(buffers_[i].buffer(), endpoint_, 0, err_);
+      if (!err_)
+      {
+        _stats.syscalls++;
+        _stats.datagrams++;
+      }
+    }
+#endif
+    _stats.bytes += sent_bytes;
+    return sent_bytes;
+  }
+
+  /**
+   * @brief Reads up to count_ of the datagrams that are already waiting,
+   * without blocking. Not finding any is not an error. With offload, count_
+   * needs to be at least MaxSegments.
+   * @return how many buffers were filled, from the first one
+   */
+  size_t receive(InputBuffer* buffers_, size_t count_, std::error_code& err_)
+  {
+#if defined(__linux__)
+    // With offload every message gets room for as many segments as the
+    // kernel may have coalesced.
+    const size_t per_message = _offload ? MaxSegments : 1;
+    assert(count_ >= per_message);
+    const size_t batch = std::min(MaxBatch, count_ / per_message);
+
+    std::array<iovec, MaxBatch> iovecs;
+    std::array<mmsghdr, MaxBatch> msgs;
+    for (size_t i = 0; i < batch; ++i)
+    {
+      iovecs[i] = iovec{buffers_ + i * per_message, per_message * InputBuffer::MTU};
+
+      msgs[i] = mmsghdr{};
+      msgs[i].msg_hdr.msg_iov = &iovecs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    const int n = ::recvmmsg(
+        _socket.native_handle(), msgs.data(), static_cast<unsigned>(batch), MSG_DONTWAIT, nullptr);
+    _more_waiting = n == static_cast<int>(batch);
+    if (n <= 0)
+    {
+      _stats.empty_reads++;
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+      {
+        err_ = std::error_code(errno, std::system_category());
+      }
+      return 0;
+    }
+    _stats.syscalls++;
+
+    // Pack the segments of all the messages together at the front
+    size_t received = 0;
+    for (int i = 0; i < n; ++i)
+    {
+      if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+      {
+        err_ = std::make_error_code(std::errc::message_size);
+      }
+
+      _stats.bytes += msgs[i].msg_len;
+      const size_t segments = (msgs[i].msg_len + InputBuffer::MTU - 1) / InputBuffer::MTU;
+      InputBuffer* const first = buffers_ + i * per_message;
+      if (first != buffers_ + received)
+      {
+        std::move(first, first + segments, buffers_ + received);
+      }
+      received += segments;
+    }
+#else
+    const size_t batch = std::min(MaxBatch, count_);
+    size_t received = 0;
+    while (received < batch && _socket.available(err_) > 0 && !err_)
+    {
+      _stats.bytes += _socket.receive(buffers_[received].data(), 0, err_);
+      if (err_)
+      {
+        break;
+      }
+      _stats.syscalls++;
+      received++;
+    }
+    _stats.empty_reads += received == 0 ? 1 : 0;
+    _more_waiting = received == batch;
+#endif
+    _stats.datagrams += received;
+    return received;
+  }
+
+  /**
+   * @brief The counts since the last call.
+   */
+  Stats take_stats() { return std::exchange(_stats, Stats{}); }
+
+private:
+#if defined(__linux__)
+  bool stop_segmenting()
+  {
+    const int segment_size = 0;
+    _segmenting = ::setsockopt(_socket.native_handle(),
+                               IPPROTO_UDP,
+                               UDP_SEGMENT,
+                               &segment_size,
+                               sizeof(segment_size)) != 0;
+    return !_segmenting;
+  }
+#endif
+
+
+  ::asio::ip::udp::socket& _socket;
+  Stats _stats;
+  bool _offload{};
+  bool _segmenting{};
+  bool _more_waiting{};
+};
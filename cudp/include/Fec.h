@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <asio/buffer.hpp>
+
+#include "InputBuffer.h"
+
+/**
+ * @brief Forward error correction with XOR parity.
+ *
+ * The data parts of a frame are taken in groups of `group` parts, and every
+ * group gets `parity` parity parts: parity j is the XOR of the payloads of
+ * parts j, j + parity, j + 2 * parity... of the group. Any single part lost
+ * under a parity can be rebuilt from it and the others, so a burst of up to
+ * `parity` consecutive losses in a group is recovered, for parity / group
+ * extra bandwidth. A group never gets more parity parts than it has data
+ * parts, which only matters for the last group of a frame, the only one that
+ * can be short.
+ */
+struct Fec
+{
+  int16_t group{};
+  int16_t parity{};
+
+  bool enabled() const { return group > 0 && parity > 0; }
+
+  /**
+   * @brief How many parity parts a full group gets. All the groups but the
+   * last are full, so the parity parts of group g start at g times this.
+   */
+  int parity_per_group() const { return std::min(parity, group); }
+
+  int parity_parts(int data_parts_) const
+  {
+    return enabled() ? data_parts_ / group * parity_per_group() +
+                           std::min<int>(parity, data_parts_ % group) :
+                       0;
+  }
+
+  /**
+   * @brief The part_id of the parity part protecting data part part_id_.
+   */
+  int parity_of(int part_id_, int data_parts_) const
+  {
+    const int g = part_id_ / group;
+    return data_parts_ + g * parity_per_group() + part_id_ % group % parity_per_group();
+  }
+
+  /**
+   * @brief Calls f_ with the part_id of every data part that the parity part
+   * parity_id_ protects.
+   */
+  template <typename F>
+  void for_each_protected(int parity_id_, int data_parts_, F&& f_) const
+  {
+    const int per_group = parity_per_group();
+    const int g = (parity_id_ - data_parts_) / per_group;
+    const int first = g * group + (parity_id_ - data_parts_) % per_group;
+    const int last = std::min((g + 1) * group, data_parts_);
+    for (int part_id = first; part_id < last; part_id += per_group)
+    {
+      f_(part_id);
+    }
+  }
+
+  /**
+   * @brief Appends the parity parts for the data parts in parts_.
+   */
+  void add_parity(std::vector<InputBuffer>& parts_) const
+  {
+    const int data_parts = static_cast<int>(parts_.size());
+    if (!enabled() || data_parts == 0)
+    {
+      return;
+    }
+
+    parts_.resize(data_parts + parity_parts(data_parts));
+    for (int parity_id = data_parts; parity_id < static_cast<int>(parts_.size()); ++parity_id)
+    {
+      InputBuffer::Header h = parts_.front().get_header();
+      h.part_id = static_cast<int16_t>(parity_id);
+      h.part_begin = 0;
+      h.part_size = static_cast<int32_t>(InputBuffer::writable_size());
+
+      InputBuffer& parity_part = parts_[parity_id];
+      parity_part.set_header(h);
+      const ::asio::mutable_buffer payload = parity_part.payload();
+      std::memset(payload.data(), 0, payload.size());
+      for_each_protected(parity_id,
+                         data_parts,
+                         [&](int part_id_)
+                         { xor_into(parity_part.payload(), parts_[part_id_].parse().second); });
+    }
+  }
+
+  static void xor_into(::asio::mutable_buffer to_, ::asio::const_buffer from_)
+  {
+    auto* to = static_cast<uint8_t*>(to_.data());
+    const auto* from = static_cast<const uint8_t*>(from_.data());
+    const size_t size = std::min(to_.size(), from_.size());
+    for (size_t i = 0; i < size; ++i)
+    {
+      to[i] ^= from[i];
+    }
+  }
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Up to a fixed number of equally sized buffers, handed out and taken
+ * back without allocating: a buffer is only allocated the first time there is
+ * no free one to hand out, so once the pool has grown to what is in use at
+ * the same time it allocates no more.
+ */
+class FrameBufferPool
+{
+public:
+  FrameBufferPool(size_t max_buffers_, size_t buffer_size_)
+      : _max_buffers(max_buffers_), _buffer_size(buffer_size_)
+  {
+    _free.reserve(max_buffers_);
+  }
+
+  /**
+   * @brief A buffer of buffer_size() bytes, with whatever was left in it.
+   * Throws if all the max_buffers_ are out already.
+   */
+  std::vector<uint8_t> acquire()
+  {
+    if (!_free.empty())
+    {
+      std::vector<uint8_t> buffer = std::move(_free.back());
+      _free.pop_back();
+      return buffer;
+    }
+
+    if (_allocated == _max_buffers)
+    {
+      throw std::runtime_error("FrameBufferPool exhausted");
+    }
+    _allocated++;
+    return std::vector<uint8_t>(_buffer_size);
+  }
+
+  /**
+   * @brief Takes back a buffer that acquire() handed out. One that can not be
+   * handed out again, e.g. because it was resized, is dropped and no longer
+   * counts towards max_buffers_.
+   */
+  void release(std::vector<uint8_t>&& buffer_)
+  {
+    if (buffer_.size() == _buffer_size && _free.size() < _max_buffers)
+    {
+      _free.push_back(std::move(buffer_));
+      return;
+    }
+
+    assert(_allocated > 0);
+    _allocated--;
+    buffer_ = {};
+  }
+
+  size_t buffer_size() const { return _buffer_size; }
+
+  /**
+   * @brief How many buffers the pool has allocated and not dropped, whether
+   * handed out or free.
+   */
+  size_t allocated() const { return _allocated; }
+
+private:
+  size_t _max_buffers;
+  size_t _buffer_size;
+  size_t _allocated{};
+  std::vector<std::vector<uint8_t>> _free;
+};
@@ -0,0 +1,436 @@
+#pragma once
+
+#include "opencv2/opencv.hpp"
+
+#include <array>
+#include <cassert>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include <asio/buffer.hpp>
+
+#include "Fec.h"
+#include "FrameBufferPool.h"
+#include "InputBuffer.h"
+#include "Logger.h"
+#include "PartsBitset.h"
+
+/**
+ * @brief Puts a frame together from its parts. It is meant to be reused for
+ * frame after frame, so that once its vectors have grown to fit a frame it
+ * allocates nothing.
+ */
+struct FrameStitcher
+{
+  // The largest frame we can put together
+  constexpr static size_t MaxFrameSize = 5 * MB;
+  constexpr static int MaxDataParts =
+      (MaxFrameSize + InputBuffer::writable_size() - 1) / InputBuffer::writable_size();
+
+  // A group never gets more parity parts than it has data parts, see Fec, so
+  // a frame has at most as many parity parts as data parts. is_valid() still
+  // checks the total, headers come off the network.
+  constexpr static int MaxParts = 2 * MaxDataParts;
+
+  enum class Part
+  {
+    Added,
+    // The original of a part that was rebuilt from parity before it arrived
+    Late,
+    Duplicate,
+    Rejected
+  };
+
+  /**
+   * @brief Whether h_ describes a frame we can put together, so that its
+   * parts can be trusted to stay within the image buffer.
+   */
+  static bool is_valid(const InputBuffer::Header& h_)
+  {
+    const Fec fec{h_.fec_group, h_.fec_parity};
+    return h_.total_parts > 0 && h_.total_parts <= MaxDataParts &&
+           h_.frame_size > (h_.total_parts - 1) * static_cast<int>(InputBuffer::writable_size()) &&
+           h_.frame_size <= h_.total_parts * static_cast<int>(InputBuffer::writable_size()) &&
+           h_.frame_size <= static_cast<int>(MaxFrameSize) &&
+           (!fec.enabled() || fec.parity <= fec.group) &&
+           h_.total_parts + fec.parity_parts(h_.total_parts) <= MaxParts && h_.part_id >= 0 &&
+           h_.part_id < h_.total_parts + fec.parity_parts(h_.total_parts);
+  }
+
+  /**
+   * @brief Starts over with the frame of h_, to be put together in
+   * image_buffer_.
+   */
+  void reset(const InputBuffer::Header& h_, std::vector<uchar>&& image_buffer_)
+  {
+    assert(is_valid(h_));
+    assert(image_buffer_.size() >= MaxFrameSize);
+    _frame_id = h_.frame_id;
+    _missing_parts = h_.total_parts;
+    _data_parts = h_.total_parts;
+    _fec = Fec{h_.fec_group, h_.fec_parity};
+    _frame_size = h_.frame_size;
+    _recovered_parts = 0;
+    [[maybe_unused]] const bool fits =
+        _arrived.reset(h_.total_parts + _fec.parity_parts(h_.total_parts)) &&
+        _rebuilt.reset(h_.total_parts);
+    assert(fits);
+    _parity.clear();
+    _image_buffer = std::move(image_buffer_);
+  }
+
+  /**
+   * @brief Gives back the image buffer, after which the stitcher is not in
+   * use until the next reset().
+   */
+  std::vector<uchar> release() { return std::exchange(_image_buffer, {}); }
+
+  bool in_use() const { return !_image_buffer.empty(); }
+
+  int frame_id() const { return _frame_id; }
+
+  /**
+   * @brief Copies in part_, unless it arrived already (or was rebuilt from
+   * parity) or it does not fit the frame, e.g. because the datagram is
+   * corrupt. It can still be called once the frame is complete, to tell the
+   * parts that were rebuilt from the ones that were only late.
+   */
+  Part add(const InputBuffer::Header& h_, ::asio::const_buffer part_)
+  {
+    if (!belongs(h_, part_))
+      return Part::Rejected;
+
+    if (!_arrived.set(h_.part_id))
+    {
+      // Parts get reordered, so a part rebuilt before its original arrived
+      // was not necessarily lost, only overtaken.
+      if (h_.part_id < _data_parts && _rebuilt.clear(h_.part_id))
+      {
+        _recovered_parts--;
+        return Part::Late;
+      }
+      return Part::Duplicate;
+    }
+
+    if (h_.part_id >= _data_parts)
+    {
+      if (!is_complete())
+      {
+        add_parity(h_.part_id, part_);
+      }
+      return Part::Added;
+    }
+
+    memcpy(_image_buffer.data() + h_.part_begin, part_.data(), part_.size());
+    _missing_parts--;
+
+    if (_fec.enabled())
+    {
+      recover(_fec.parity_of(h_.part_id, _data_parts));
+    }
+    return Part::Added;
+  }
+
+  /**
+   * @brief Whether every data part is there, so the frame can be decoded.
+   */
+  bool is_complete() const { return _missing_parts == 0; }
+
+  /**
+   * @brief How many data parts have neither arrived nor been rebuilt.
+   */
+  int missing_parts() const { return _missing_parts; }
+
+  /**
+   * @brief Calls f_ with the part_id of every missing data part, in order.
+   */
+  template <typename F>
+  void for_each_missing(F&& f_) const
+  {
+    _arrived.for_each_clear(
+        0, _data_parts, [&](size_t part_id_) { f_(static_cast<int>(part_id_)); });
+  }
+
+  /**
+   * @brief How many of the parts were rebuilt from parity and have not
+   * arrived since. Only final once the frame is decoded or given up on.
+   */
+  int recovered_parts() const { return _recovered_parts; }
+
+  /**
+   * @brief Decodes the frame into frame_, reusing its memory if it already
+   * has the right size.
+   */
+  void decode(cv::Mat& frame_) const
+  {
+    assert(is_complete());
+    assert(_frame_size > 0 && static_cast<size_t>(_frame_size) <= _image_buffer.size());
+    const cv::Mat encoded(1, _frame_size, CV_8UC1, const_cast<uchar*>(_image_buffer.data()));
+    cv::imdecode(encoded, cv::IMREAD_UNCHANGED, &frame_);
+  }
+
+private:
+  bool belongs(const InputBuffer::Header& h_, ::asio::const_buffer part_)
+  {
+    if (h_.frame_id != _frame_id || h_.total_parts != _data_parts || h_.frame_size != _frame_size ||
+        h_.fec_group != _fec.group || h_.fec_parity != _fec.parity || h_.part_id < 0 ||
+        h_.part_id >= static_cast<int>(_arrived.size()))
+      return false;
+
+    if (h_.part_id >= _data_parts)
+      return part_.size() == InputBuffer::writable_size();
+
+    const ::asio::mutable_buffer expected = part(h_.part_id);
+    return h_.part_begin == h_.part_id * static_cast<int>(InputBuffer::writable_size()) &&
+           part_.size() == expected.size();
+  }
+
+  void add_parity(int parity_id_, ::asio::const_buffer part_)
+  {
+    if (_parity.empty())
+    {
+      _parity.resize(_arrived.size() - _data_parts);
+    }
+
+    InputBuffer& parity = _parity[parity_id_ - _data_parts];
+    parity.set_frame_part(part_);
+    recover(parity_id_);
+  }
+
+  /**
+   * @brief Rebuilds the data part protected by parity_id_, if it is the only
+   * one missing and the parity is there.
+   */
+  void recover(int parity_id_)
+  {
+    if (!_arrived.test(parity_id_))
+      return;
+
+    int missing = -1;
+    int missing_num = 0;
+    _fec.for_each_protected(parity_id_,
+                            _data_parts,
+                            [&](int part_id_)
+                            {
+                              if (!_arrived.test(part_id_))
+                              {
+                                missing = part_id_;
+                                missing_num++;
+                              }
+                            });
+    if (missing_num != 1)
+      return;
+
+    // The parity is the XOR of the payloads of all the parts it protects
+    const ::asio::mutable_buffer rebuilt = part(missing);
+    const InputBuffer& parity = _parity[parity_id_ - _data_parts];
+    memcpy(rebuilt.data(), parity.parse().second.data(), rebuilt.size());
+    _fec.for_each_protected(parity_id_,
+                            _data_parts,
+                            [&](int part_id_)
+                            {
+                              if (part_id_ != missing)
+                              {
+                                Fec::xor_into(rebuilt, part(part_id_));
+                              }
+                            });
+
+    _arrived.set(missing);
+    _rebuilt.set(missing);
+    _missing_parts--;
+    _recovered_parts++;
+  }
+
+  /**
+   * @brief Where data part part_id_ goes in the image.
+   */
+  ::asio::mutable_buffer part(int part_id_)
+  {
+    const size_t begin = part_id_ * InputBuffer::writable_size();
+    const size_t size = part_id_ + 1 == _data_parts ? _frame_size - begin :
+                                                       InputBuffer::writable_size();
+    assert(begin + size <= _image_buffer.size());
+    return ::asio::mutable_buffer(_image_buffer.data() + begin, size);
+  }
+
+  int _frame_id{};
+  int _missing_parts{};
+  int _data_parts{};
+  Fec _fec;
+  int _frame_size{};
+  int _recovered_parts{};
+  // Data parts first, then parity parts
+  PartsBitset<MaxParts> _arrived;
+  // The data parts rebuilt from parity whose original has not arrived
+  PartsBitset<MaxDataParts> _rebuilt;
+  std::vector<InputBuffer> _parity;
+  std::vector<uchar> _image_buffer;
+};
+
+/**
+ * @brief Keeps the frames still coming in, in a table of Window stitchers
+ * indexed by frame_id % Window, and lends them image buffers from a pool, so
+ * that in steady state nothing is allocated per frame.
+ */
+struct FramesManager
+{
+  // How many frames behind the newest one we still wait for the parts of
+  constexpr static int OldFrameAllowance = 10;
+
+  // Enough slots for every frame within the allowance to have its own
+  constexpr static int Window = 16;
+  static_assert(Window > OldFrameAllowance);
+
+  struct Stats
+  {
+    int64_t decoded_frames{};
+    // Given up on with parts still missing, and how many were missing
+    int64_t incomplete_frames{};
+    int64_t lost_parts{};
+    // Rebuilt from parity, with the original still missing when the frame
+    // was decoded or given up on
+    int64_t recovered_parts{};
+    int64_t duplicate_parts{};
+    // Parts that did not fit their frame, e.g. corrupt ones
+    int64_t rejected_parts{};
+  };
+
+  FramesManager() : _buffers(Window, FrameStitcher::MaxFrameSize) {}
+
+  void add(const InputBuffer::Header& h_, ::asio::const_buffer part_)
+  {
+    if (h_.frame_id < _last_frame_id - OldFrameAllowance or h_.frame_id < _last_complete_frame or
+        h_.frame_id <= _last_decoded_frame)
+    {
+      // Too old, throw it away
+      Logger::Debug("Got old frame", h_.frame_id, ". Discarded");
+      return;
+    }
+
+    FrameStitcher& frameStitcher = _frames[slot(h_.frame_id)];
+    if (!frameStitcher.in_use() || frameStitcher.frame_id() != h_.frame_id)
+    {
+      if (!FrameStitcher::is_valid(h_))
+      {
+        Logger::Debug("Got invalid part for frame", h_.frame_id, ". Discarded");
+        _stats.rejected_parts++;
+        return;
+      }
+
+      // Whatever was in the slot is past the allowance by now, so start with
+      // the new one
+      release(frameStitcher);
+      frameStitcher.reset(h_, _buffers.acquire());
+    }
+
+    Logger::Debug("Got frame id", h_.frame_id, ". Current last frame id", _last_frame_id);
+    _last_frame_id = std::max(_last_frame_id, h_.frame_id);
+
+    // Parts still go in once it is complete and waiting to be decoded, to
+    // tell the ones rebuilt from parity from those that were only late.
+    const bool was_complete = frameStitcher.is_complete();
+    switch (frameStitcher.add(h_, part_))
+    {
+    case FrameStitcher::Part::Added:
+      break;
+    case FrameStitcher::Part::Late:
+      return;
+    case FrameStitcher::Part::Duplicate:
+      _stats.duplicate_parts++;
+      return;
+    case FrameStitcher::Part::Rejected:
+      _stats.rejected_parts++;
+      return;
+    }
+
+    if (!was_complete && frameStitcher.is_complete())
+    {
+      if (h_.frame_id >= _last_frame_id)
+      {
+        _last_complete_frame = h_.frame_id;
+      }
+      else
+      {
+        // It's stale, throw it away
+        release(frameStitcher);
+      }
+    }
+  }
+
+  bool is_frame_ready() const { return _last_complete_frame != -1; }
+
+  /**
+   * @brief Calls f_ with the part_id of every data part of frame_id_ that is
+   * still missing, e.g. to ask for them again.
+   * @return false if frame_id_ is not being put together
+   */
+  template <typename F>
+  bool for_each_missing(int frame_id_, F&& f_) const
+  {
+    const FrameStitcher& frameStitcher = _frames[slot(frame_id_)];
+    if (!frameStitcher.in_use() || frameStitcher.frame_id() != frame_id_)
+      return false;
+
+    frameStitcher.for_each_missing(std::forward<F>(f_));
+    return true;
+  }
+
+  /**
+   * @brief Decodes the last complete frame into frame_, and forgets about it
+   * and about all the frames before it.
+   */
+  void get_last_frame(cv::Mat& frame_)
+  {
+    assert(_last_complete_frame > -1);
+    _frames[slot(_last_complete_frame)].decode(frame_);
+    Logger::Debug("Decoded frame", _last_complete_frame);
+    _stats.decoded_frames++;
+
+    _last_decoded_frame = _last_complete_frame;
+    _last_complete_frame = -1;
+
+    // Clean all old frames
+    for (FrameStitcher& frameStitcher : _frames)
+    {
+      if (frameStitcher.in_use() && frameStitcher.frame_id() <= _last_decoded_frame)
+      {
+        release(frameStitcher);
+      }
+    }
+  }
+
+  /**
+   * @brief The counts since the last call.
+   */
+  Stats take_stats() { return std::exchange(_stats, Stats{}); }
+
+private:
+  static size_t slot(int frame_id_) { return static_cast<unsigned>(frame_id_) % Window; }
+
+  void release(FrameStitcher& frame_stitcher_)
+  {
+    if (!frame_stitcher_.in_use())
+      return;
+
+    if (frame_stitcher_.frame_id() == _last_complete_frame)
+    {
+      _last_complete_frame = -1;
+    }
+    if (!frame_stitcher_.is_complete())
+    {
+      _stats.incomplete_frames++;
+      _stats.lost_parts += frame_stitcher_.missing_parts();
+    }
+    // Only now that no original can turn up anymore
+    _stats.recovered_parts += frame_stitcher_.recovered_parts();
+    _buffers.release(frame_stitcher_.release());
+  }
+
+  int _last_complete_frame{-1};
+  int _last_decoded_frame{-1};
+  int _last_frame_id{};
+  Stats _stats;
+  std::array<FrameStitcher, Window> _frames;
+  FrameBufferPool _buffers;
+};
@@ -27,6 +27,12 @@ struct InputBuffer
     int16_t total_parts{};
     int32_t part_size{};
 
+    // Forward error correction, see Fec.h. Parity parts come after the
+    // total_parts data parts, with a part_id of total_parts or more.
+    int16_t fec_group{};
+    int16_t fec_parity{};
+    int32_t frame_size{};
+
     friend std::ostream& operator<<(std::ostream& o, const Header& h)
     {
       o << "Frame id: " << h.frame_id << ", part num: " << h.part_id
@@ -52,13 +58,26 @@ struct InputBuffer
 
   void set_header(const Header& h_) { memcpy(_recv_buff.data(), &h_, sizeof(h_)); }
 
+  /**
+   * @brief Copies buf_ in as the payload, zeroing whatever is left of it so
+   * that parity can be computed over the whole payload.
+   */
   void set_frame_part(::asio::const_buffer buf_)
   {
     assert(buf_.size() <= writable_size());
     memcpy(_recv_buff.data() + sizeof(Header), buf_.data(), buf_.size());
+    memset(_recv_buff.data() + sizeof(Header) + buf_.size(), 0, writable_size() - buf_.size());
+  }
+
+  /**
+   * @brief The whole payload, whatever the part_size in the header.
+   */
+  ::asio::mutable_buffer payload()
+  {
+    return ::asio::mutable_buffer(_recv_buff.data() + sizeof(Header), writable_size());
   }
 
-  static size_t writable_size() { return MTU - sizeof(Header); }
+  constexpr static size_t writable_size() { return MTU - sizeof(Header); }
 
   ::asio::mutable_buffer data()
   {
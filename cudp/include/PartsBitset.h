@@ -0,0 +1,114 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Which of the parts of a frame arrived, one bit each, in storage
+ * sized for the largest frame so that starting over with a new frame never
+ * allocates and only clears the words the frame uses.
+ */
+template <size_t MaxBits>
+class PartsBitset
+{
+public:
+  /**
+   * @brief Starts over with size_ bits, all clear.
+   * @return false, leaving no bits at all, if size_ is more than MaxBits
+   */
+  bool reset(size_t size_)
+  {
+    for (size_t w = 0; w < words(_size); ++w)
+    {
+      _words[w] = 0;
+    }
+    _size = size_ <= MaxBits ? size_ : 0;
+    return _size == size_;
+  }
+
+  size_t size() const { return _size; }
+
+  /**
+   * @brief Whether bit i_ is set. Bits past size() never are.
+   */
+  bool test(size_t i_) const
+  {
+    if (i_ >= _size)
+    {
+      return false;
+    }
+    return (_words[i_ / WordBits] >> (i_ % WordBits)) & 1u;
+  }
+
+  /**
+   * @brief Sets bit i_, unless it is past size().
+   * @return false if it was already set or is past size()
+   */
+  bool set(size_t i_)
+  {
+    if (i_ >= _size)
+    {
+      return false;
+    }
+    const uint64_t bit = uint64_t{1} << (i_ % WordBits);
+    uint64_t& word = _words[i_ / WordBits];
+    const bool was_clear = (word & bit) == 0;
+    word |= bit;
+    return was_clear;
+  }
+
+  /**
+   * @brief Clears bit i_, unless it is past size().
+   * @return false if it was already clear or is past size()
+   */
+  bool clear(size_t i_)
+  {
+    if (i_ >= _size)
+    {
+      return false;
+    }
+    const uint64_t bit = uint64_t{1} << (i_ % WordBits);
+    uint64_t& word = _words[i_ / WordBits];
+    const bool was_set = (word & bit) != 0;
+    word &= ~bit;
+    return was_set;
+  }
+
+  /**
+   * @brief Calls f_ with the index of every clear bit in [begin_, end_), in
+   * order, skipping 64 set bits at a time.
+   */
+  template <typename F>
+  void for_each_clear(size_t begin_, size_t end_, F&& f_) const
+  {
+    assert(begin_ <= end_ && end_ <= _size);
+    for (size_t w = begin_ / WordBits; w * WordBits < end_; ++w)
+    {
+      uint64_t clear = ~_words[w];
+      while (clear != 0)
+      {
+        const size_t i = w * WordBits + std::countr_zero(clear);
+        clear &= clear - 1;
+        if (i >= end_)
+        {
+          return;
+        }
+        if (i >= begin_)
+        {
+          f_(i);
+        }
+      }
+    }
+  }
+
+private:
+  constexpr static size_t WordBits = 64;
+
+  static size_t words(size_t bits_) { return (bits_ + WordBits - 1) / WordBits; }
+
+  std::array<uint64_t, (MaxBits + WordBits - 1) / WordBits> _words{};
+  size_t _size{};
+};
@@ -0,0 +1,208 @@
+#include "opencv2/opencv.hpp"
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <asio/buffer.hpp>
+#include <asio/io_context.hpp>
+#include <asio/ip/udp.hpp>
+
+#include "BatchedSocket.h"
+#include "Fec.h"
+#include "FramesManager.h"
+#include "InputBuffer.h"
+#include "Logger.h"
+
+/**
+ * Streams synthetic frames over loopback, dropping parts at random before
+ * they are sent, and reports how many frames the receiver could still put
+ * together with each FEC setting against how much more it had to send.
+ */
+
+namespace
+{
+const int FramesPerRun = 200;
+
+/**
+ * @brief Splits frame_ into parts like the sender does, parity included.
+ */
+void split(const std::vector<uchar>& frame_,
+           int frame_id_,
+           Fec fec_,
+           std::vector<InputBuffer>& parts_)
+{
+  const int16_t parts_num =
+      (frame_.size() + InputBuffer::writable_size() - 1) / InputBuffer::writable_size();
+  parts_.resize(parts_num);
+  for (int16_t part_id = 0; part_id < parts_num; ++part_id)
+  {
+    InputBuffer::Header h;
+    h.frame_id = frame_id_;
+    h.part_id = part_id;
+    h.total_parts = parts_num;
+    h.fec_group = fec_.group;
+    h.fec_parity = fec_.parity;
+    h.frame_size = static_cast<int32_t>(frame_.size());
+    h.part_begin = part_id * InputBuffer::writable_size();
+    h.part_size = part_id + 1 == parts_num ? frame_.size() - h.part_begin :
+                                             InputBuffer::writable_size();
+
+    parts_[part_id].set_header(h);
+    parts_[part_id].set_frame_part(
+        ::asio::const_buffer(frame_.data() + h.part_begin, h.part_size));
+  }
+  fec_.add_parity(parts_);
+}
+
+struct RunResult
+{
+  int completed{};
+  int corrupted{};
+  int64_t data_bytes{};
+  int64_t sent_bytes{};
+  int64_t recovered_parts{};
+};
+
+RunResult run(::asio::ip::udp::socket& sender_,
+              ::asio::ip::udp::socket& receiver_,
+              const std::vector<std::vector<uchar>>& frames_,
+              const std::vector<cv::Mat>& expected_,
+              Fec fec_,
+              double loss_,
+              int& frame_id_)
+{
+  BatchedSocket sender(sender_);
+  BatchedSocket receiver(receiver_);
+  const ::asio::ip::udp::endpoint endpoint = receiver_.local_endpoint();
+
+  // The same losses for every setting
+  std::mt19937 rng(42);
+  std::bernoulli_distribution lost(loss_);
+
+  FramesManager frames_manager;
+  std::vector<InputBuffer> parts;
+  std::vector<InputBuffer> survivors;
+  std::vector<InputBuffer> received(BatchedSocket::BatchBuffers);
+  cv::Mat decoded;
+  RunResult result;
+
+  for (int i = 0; i < FramesPerRun; ++i)
+  {
+    const size_t frame = i % frames_.size();
+    split(frames_[frame], ++frame_id_, fec_, parts);
+    result.data_bytes += parts.front().get_header().total_parts * InputBuffer::MTU;
+    result.sent_bytes += parts.size() * InputBuffer::MTU;
+
+    survivors.clear();
+    for (InputBuffer& part : parts)
+    {
+      if (!lost(rng))
+      {
+        survivors.push_back(part);
+      }
+    }
+
+    std::error_code err;
+    sender.send_to(survivors.data(), survivors.size(), endpoint, err);
+    if (err)
+    {
+      Logger::Error("Send error", err.message());
+      return result;
+    }
+
+    // Loopback delivers as it sends, so whatever made it is already waiting
+    size_t n = 0;
+    while ((n = receiver.receive(received.data(), received.size(), err)) != 0)
+    {
+      for (size_t p = 0; p < n; ++p)
+      {
+        auto [header, part] = received[p].parse();
+        frames_manager.add(header, part);
+      }
+    }
+
+    if (frames_manager.is_frame_ready())
+    {
+      result.completed++;
+      frames_manager.get_last_frame(decoded);
+      if (decoded.empty() || cv::norm(decoded, expected_[frame], cv::NORM_INF) != 0)
+      {
+        result.corrupted++;
+      }
+    }
+  }
+  result.recovered_parts = frames_manager.take_stats().recovered_parts;
+  return result;
+}
+} // namespace
+
+int main()
+{
+  Logger::SetLevel(Logger::INFO);
+
+  ::asio::io_context io_context;
+  const ::asio::ip::udp::endpoint any_port(::asio::ip::make_address("127.0.0.1"), 0);
+  ::asio::ip::udp::socket receiver(io_context, any_port);
+  receiver.set_option(::asio::socket_base::receive_buffer_size(8 * MB));
+  ::asio::ip::udp::socket sender(io_context);
+  sender.open(::asio::ip::udp::v4());
+
+  // Noise compresses badly, so every frame takes dozens of parts
+  std::vector<std::vector<uchar>> frames(4);
+  std::vector<cv::Mat> expected;
+  cv::RNG cv_rng(7);
+  for (std::vector<uchar>& frame : frames)
+  {
+    cv::Mat image(480, 640, CV_8UC3);
+    cv_rng.fill(image, cv::RNG::UNIFORM, 0, 256);
+    cv::imencode(".jpg", image, frame, {cv::IMWRITE_JPEG_QUALITY, 50});
+    expected.push_back(cv::imdecode(frame, cv::IMREAD_UNCHANGED));
+  }
+
+  const std::vector<Fec> settings = {Fec{}, Fec{20, 1}, Fec{10, 1}, Fec{10, 2}, Fec{10, 4}};
+  const std::vector<double> losses = {0., .001, .005, .01, .02, .05};
+
+  int frame_id = 0;
+  bool ok = true;
+  std::printf("%-10s %9s", "fec", "overhead");
+  for (const double loss : losses)
+  {
+    std::printf(" %7.1f%%", loss * 100);
+  }
+  std::printf(" %8s   <- loss rate, frames completed below\n", "rebuilt");
+
+  for (const Fec fec : settings)
+  {
+    const std::string name =
+        fec.enabled() ? std::to_string(fec.group) + ":" + std::to_string(fec.parity) : "off";
+
+    std::vector<RunResult> results;
+    for (const double loss : losses)
+    {
+      results.push_back(run(sender, receiver, frames, expected, fec, loss, frame_id));
+    }
+
+    std::printf("%-10s %8.1f%%",
+                name.c_str(),
+                100. * (results.front().sent_bytes - results.front().data_bytes) /
+                    results.front().data_bytes);
+    int64_t recovered_parts = 0;
+    for (const RunResult& r : results)
+    {
+      std::printf(" %7.1f%%", 100. * r.completed / FramesPerRun);
+      recovered_parts += r.recovered_parts;
+      ok = ok && r.corrupted == 0;
+    }
+    std::printf(" %8lld\n", static_cast<long long>(recovered_parts));
+
+    // With nothing lost every frame has to make it
+    ok = ok && results.front().completed == FramesPerRun;
+  }
+
+  if (!ok)
+  {
+    Logger::Error("Frames were corrupted, or lost with no loss at all");
+  }
+  return ok ? 0 : 1;
+}
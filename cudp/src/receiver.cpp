@@ -1,14 +1,15 @@
 #include "opencv2/opencv.hpp"
 #include <chrono>
 #include <iostream>
-#include <map>
 #include <thread>
 
 #include <asio/buffer.hpp>
 #include <asio/io_context.hpp>
 #include <asio/ip/udp.hpp>
 
+#include "BatchedSocket.h"
 #include "CountdownTimer.h"
+#include "FramesManager.h"
 #include "InputBuffer.h"
 #include "Logger.h"
 #include "OpenCVUtils.h"
@@ -16,107 +17,7 @@
 #include "VideoWindow.h"
 #include "lockfree_spsc.h"
 
-struct FrameStitcher
-{
-  explicit FrameStitcher(int parts_num_) : _parts_num(parts_num_), _image_buffer(5 * MB) {}
-
-  FrameStitcher(FrameStitcher&&) = default;
-
-  void add(const InputBuffer::Header& h_, ::asio::const_buffer part_)
-  {
-    if (_parts_num <= 0)
-      return;
-    assert(_parts_num > 0);
-    assert(h_.part_begin + part_.size() <= _image_buffer.size());
-
-    memcpy(_image_buffer.data() + h_.part_begin, part_.data(), part_.size());
-    _parts_num--;
-  }
-
-  bool is_complete() const { return _parts_num == 0; }
-
-  cv::Mat decoded() const
-  {
-    assert(is_complete());
-    return cv::imdecode(_image_buffer, cv::IMREAD_UNCHANGED);
-  }
-
-private:
-  int _parts_num;
-  std::vector<uchar> _image_buffer;
-};
-
-struct FramesManager
-{
-  void add(const InputBuffer::Header& h_, ::asio::const_buffer part_)
-  {
-    const int old_frame_allowance = 10;
-    if (h_.frame_id < _last_frame_id - old_frame_allowance or h_.frame_id < _last_complete_frame)
-    {
-      // Too old, throw it away
-      Logger::Debug("Got old frame", h_.frame_id, ". Discarded");
-      return;
-    }
-    else
-    {
-      Logger::Debug("Got frame id", h_.frame_id, ". Current last frame id", _last_frame_id);
-      // Throw away the old one and start with the new one
-      _last_frame_id = std::max(_last_frame_id, h_.frame_id);
-      _frames.erase(_last_frame_id - old_frame_allowance);
-    }
-
-    auto frameIter = _frames.find(h_.frame_id);
-    if (frameIter == _frames.cend())
-    {
-      // TimeLogger t("New frame found: " + std::to_string(h_.frame_id),
-      //            std::cout);
-      frameIter = _frames.insert(std::make_pair(h_.frame_id, FrameStitcher(h_.total_parts))).first;
-    }
-
-    auto& frameStitcher = frameIter->second;
-
-    frameStitcher.add(h_, part_);
-
-    if (frameStitcher.is_complete())
-    {
-      if (h_.frame_id >= _last_frame_id)
-      {
-        _last_complete_frame = h_.frame_id;
-      }
-      else
-      {
-        // It's stale, throw it away
-        _frames.erase(h_.frame_id);
-      }
-    }
-  }
-
-  bool is_frame_ready() const { return _last_complete_frame != -1; }
-
-  cv::Mat get_last_frame()
-  {
-    assert(_last_complete_frame > -1);
-    FrameStitcher frame_stitcher = std::move(_frames.at(_last_complete_frame));
-    Logger::Debug("Decoded frame", _last_complete_frame);
-
-    // Clean all old frames
-    for (int i = _last_cleaned; i < _last_complete_frame; ++i)
-    {
-      _frames.erase(i);
-    }
-
-    _last_complete_frame = -1;
-    return frame_stitcher.decoded();
-  }
-
-private:
-  int _last_cleaned{};
-  int _last_complete_frame{-1};
-  int _last_frame_id{};
-  std::map<int, FrameStitcher> _frames;
-};
-
-void receiver(const std::string& recv_address_)
+void receiver(const std::string& recv_address_, bool offload_)
 {
   try
   {
@@ -128,8 +29,6 @@ void receiver(const std::string& recv_address_)
 
     const int recv_port = 39009;
 
-    InputBuffer input_buffer;
-
     ::asio::ip::udp::endpoint recv_endpoint(::asio::ip::make_address(recv_address_),
                                             recv_port);
 
@@ -139,63 +38,116 @@ void receiver(const std::string& recv_address_)
 
     lockfree_spsc<InputBuffer> disruptor(10000);
 
+    BatchedSocket batched_socket(recv_socket);
+    std::error_code offload_err;
+    if (offload_ && !batched_socket.enable_offload(offload_err))
+    {
+      Logger::Warning("UDP GRO not available:", offload_err.message());
+    }
+    std::array<InputBuffer, BatchedSocket::BatchBuffers> batch;
+
     struct Handler
     {
       Handler(::asio::ip::udp::socket& socket_,
-              InputBuffer& input_buffer_,
+              BatchedSocket& batched_socket_,
+              std::array<InputBuffer, BatchedSocket::BatchBuffers>& batch_,
               lockfree_spsc<InputBuffer>& disruptor_)
-          : _socket(socket_), _input_buffer(input_buffer_), _disruptor(disruptor_)
+          : _socket(socket_),
+            _batched_socket(batched_socket_),
+            _batch(batch_),
+            _disruptor(disruptor_)
       {
       }
 
-      void operator()(asio::error_code err, std::size_t recv_size_)
+      void operator()(asio::error_code err)
       {
         if (err)
         {
           Logger::Error("Recv Err ", err.message());
+          return;
         }
-        else
+
+        // Read everything that has arrived, a batch per syscall, and hand each
+        // batch to the display thread in one go.
+        do
         {
-          static bool frame_dropped{};
-          InputBuffer::Header header = _input_buffer.get_header();
+          std::error_code recv_err;
+          const size_t received =
+              _batched_socket.receive(_batch.data(), _batch.size(), recv_err);
+          if (recv_err)
+          {
+            Logger::Error("Recv Err ", recv_err.message());
+          }
+          push(received);
+        } while (_batched_socket.more_waiting());
 
-          if (header.part_id == 0)
+        // Output Stats every second
+        static CountdownTimer timer(std::chrono::milliseconds(1000));
+        if (timer.is_it_time_yet())
+        {
+          const BatchedSocket::Stats stats = _batched_socket.take_stats();
+          Logger::Info("Streaming Rate",
+                       stats.bytes / 1000.f,
+                       "KB/s,",
+                       _frames_per_second,
+                       "frames,",
+                       stats.datagrams,
+                       "datagrams in",
+                       stats.syscalls,
+                       "syscalls,",
+                       static_cast<float>(stats.datagrams) / std::max<int64_t>(stats.syscalls, 1),
+                       "per syscall,",
+                       stats.empty_reads,
+                       "empty reads");
+          _frames_per_second = 0;
+        }
+
+        // Copies this handler, so after updating the stats
+        _socket.async_wait(::asio::ip::udp::socket::wait_read, *this);
+      }
+
+    private:
+      void push(size_t received_)
+      {
+        // Drop the parts of frames we already lost a part of
+        static bool frame_dropped{};
+        size_t kept = 0;
+        for (size_t i = 0; i < received_; ++i)
+        {
+          if (_batch[i].get_header().part_id == 0)
           {
             // Try again with new frame
             frame_dropped = false;
+            _frames_per_second++;
           }
 
-          if (!frame_dropped && !_disruptor.try_push(std::move(_input_buffer)))
+          if (!frame_dropped)
           {
-            // Couldn't insert this part, let's skip all the rest of the parts
-            // until the next frame
-            frame_dropped = true;
+            if (kept != i)
+            {
+              _batch[kept] = std::move(_batch[i]);
+            }
+            kept++;
           }
+        }
 
-          _socket.async_receive(_input_buffer.data(), *this);
-
-          static CountdownTimer timer(std::chrono::milliseconds(1000));
-          static int64_t recv_bytes_per_second = 0;
-
-          recv_bytes_per_second += recv_size_;
-
-          // Output Stats every second
-          if (timer.is_it_time_yet())
-          {
-            Logger::Info("Streaming Rate", recv_bytes_per_second / 1000.f, "KB/s");
-            recv_bytes_per_second = 0;
-          }
+        if (_disruptor.try_push_n(_batch.begin(), _batch.begin() + kept) != kept)
+        {
+          // Couldn't insert all the parts, let's skip all the rest of the
+          // parts until the next frame
+          frame_dropped = true;
         }
       }
 
-    private:
       ::asio::ip::udp::socket& _socket;
-      InputBuffer& _input_buffer;
+      BatchedSocket& _batched_socket;
+      std::array<InputBuffer, BatchedSocket::BatchBuffers>& _batch;
       lockfree_spsc<InputBuffer>& _disruptor;
+      float _frames_per_second{};
     };
 
-    Handler handler(recv_socket, input_buffer, disruptor);
-    recv_socket.async_receive(input_buffer.data(), handler);
+    Handler handler(recv_socket, batched_socket, batch, disruptor);
+    recv_socket.async_wait(::asio::ip::udp::socket::wait_read, handler);
 
     std::thread display_frame_thread(
         [&disruptor, &recv_socket]
@@ -207,8 +159,9 @@ void receiver(const std::string& recv_address_)
               static FramesManager frame_manager;
               static cv::Mat frame;
 
-              InputBuffer part_buf;
-              while (disruptor.try_pop(part_buf))
+              // Stitch every part that has arrived straight from the ring and
+              // hand all their slots back to the socket thread in one go.
+              const auto add_part = [](const InputBuffer& part_buf)
               {
                 auto [header, part] = part_buf.parse();
                 Logger::Debug("Received", header);
@@ -218,8 +171,31 @@ void receiver(const std::string& recv_address_)
                 if (frame_manager.is_frame_ready())
                 {
                   Logger::Debug("Updating Frame");
-                  frame = frame_manager.get_last_frame();
+                  frame_manager.get_last_frame(frame);
                 }
+              };
+              while (disruptor.consume_n(add_part, disruptor.capacity()) != 0)
+              {
+              }
+
+              // Output Stats every second
+              static CountdownTimer timer(std::chrono::milliseconds(1000));
+              if (timer.is_it_time_yet())
+              {
+                const FramesManager::Stats stats = frame_manager.take_stats();
+                Logger::Info("Decoded",
+                             stats.decoded_frames,
+                             "frames, gave up on",
+                             stats.incomplete_frames,
+                             "missing",
+                             stats.lost_parts,
+                             "parts, rebuilt",
+                             stats.recovered_parts,
+                             "parts, ignored",
+                             stats.duplicate_parts,
+                             "duplicate and",
+                             stats.rejected_parts,
+                             "invalid parts");
               }
 
               static float scale = 1.f;
@@ -283,6 +259,9 @@ int main(int argc, char* argv[])
     recv_address = argv[1];
   }
 
-  receiver(recv_address);
+  // Let the kernel coalesce the parts as they arrive
+  const bool offload = argc > 2 && std::string(argv[2]) == "--offload";
+
+  receiver(recv_address, offload);
   return 0;
 }
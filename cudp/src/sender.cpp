@@ -1,6 +1,7 @@
 #include "Logger.h"
 #include "opencv2/opencv.hpp"
 #include <chrono>
+#include <cstdio>
 #include <iostream>
 #include <map>
 #include <thread>
@@ -10,14 +11,16 @@
 #include <asio/ip/host_name.hpp>
 #include <asio/ip/udp.hpp>
 
+#include "BatchedSocket.h"
 #include "CountdownTimer.h"
+#include "Fec.h"
 #include "InputBuffer.h"
 #include "OpenCVUtils.h"
 #include "TimeLogger.h"
 #include "VideoWindow.h"
 #include "lockfree_spsc.h"
 
-void sender(const std::string& recv_address_)
+void sender(const std::string& recv_address_, bool offload_, Fec fec_)
 {
   try
   {
@@ -28,6 +31,13 @@ void sender(const std::string& recv_address_)
     ::asio::ip::udp::socket sender_socket(ioContext);
 
     sender_socket.open(::asio::ip::udp::v4());
+    BatchedSocket batched_socket(sender_socket);
+    std::error_code offload_err;
+    if (offload_ && !batched_socket.enable_offload(offload_err))
+    {
+      Logger::Warning("UDP GSO not available:", offload_err.message());
+    }
+    bool segmenting = batched_socket.segmenting();
 
     const int recv_port = 39009;
     ::asio::ip::udp::endpoint recv_endpoint(::asio::ip::make_address(recv_address_),
@@ -41,13 +51,29 @@ void sender(const std::string& recv_address_)
     compression_params.push_back(50);
     int& compression_rate = compression_params.back();
 
-    std::vector<uchar> buffer(20 * MB);
+    // imencode grows it to the largest frame so far, after which encoding
+    // does not allocate anymore
+    std::vector<uchar> buffer;
+    cv::Mat shown_frame;
 
     // Start at 24 fps
     float fps = 24.f;
 
+    // All the parts of a frame, parity included, sent in batches
+    std::vector<InputBuffer> parts;
+    if (fec_.enabled())
+    {
+      Logger::Info("Sending",
+                   fec_.parity,
+                   "parity parts every",
+                   fec_.group,
+                   "parts,",
+                   100.f * fec_.parity / fec_.group,
+                   "% more bandwidth");
+    }
+
     CountdownTimer timer(std::chrono::milliseconds(1000));
-    int64_t sent_bytes_per_second = 0;
+    int64_t frames_per_second = 0;
 
     while (true)
     {
@@ -74,35 +100,45 @@ void sender(const std::string& recv_address_)
       const int16_t parts_num =
           (buffer.size() + InputBuffer::writable_size() - 1) / InputBuffer::writable_size();
       Logger::Debug("Frame id", frame_id, "split in parts", parts_num);
+      parts.resize(parts_num);
       for (int16_t part_id = 0; part_id < parts_num; ++part_id)
       {
         InputBuffer::Header h;
         h.part_id = part_id;
         h.total_parts = parts_num;
+        h.fec_group = fec_.group;
+        h.fec_parity = fec_.parity;
+        h.frame_size = static_cast<int32_t>(buffer.size());
         // Size is either MTU or the remainder for the last part
         h.frame_id = frame_id;
         h.part_begin = part_id * InputBuffer::writable_size();
 
-        h.part_size = part_id + 1 == parts_num ? buffer.size() % InputBuffer::writable_size() :
+        h.part_size = part_id + 1 == parts_num ? buffer.size() - h.part_begin :
                                                  InputBuffer::writable_size();
 
-        InputBuffer input_buffer;
+        InputBuffer& input_buffer = parts[part_id];
         input_buffer.set_header(h);
         input_buffer.set_frame_part(::asio::const_buffer(
-            reinterpret_cast<const char*>(buffer.data()) + part_id * InputBuffer::writable_size(),
-            InputBuffer::writable_size()));
-
-        std::error_code err;
-        sent_bytes_per_second +=
-            sender_socket.send_to(input_buffer.buffer(), recv_endpoint, 0, err);
-        if (err)
-        {
-          Logger::Error("Error sending", err.message());
-        }
+            reinterpret_cast<const char*>(buffer.data()) + h.part_begin, h.part_size));
       }
+      fec_.add_parity(parts);
+
+      std::error_code err;
+      batched_socket.send_to(parts.data(), parts.size(), recv_endpoint, err);
+      if (err)
+      {
+        Logger::Error("Error sending", err.message());
+      }
+      if (segmenting && !batched_socket.segmenting())
+      {
+        Logger::Warning("UDP GSO turned off, a part does not fit the path MTU");
+        segmenting = false;
+      }
+      frames_per_second++;
 
       // Display the resulting frame
-      opencv_utils::displayMat(cv::imdecode(buffer, cv::IMREAD_UNCHANGED), win.getWindowName());
+      cv::imdecode(buffer, cv::IMREAD_UNCHANGED, &shown_frame);
+      opencv_utils::displayMat(shown_frame, win.getWindowName());
 
       const auto timepoint_after_sending = std::chrono::system_clock::now();
       auto frame_duration = (timepoint_after_sending - timepoint_before_compression);
@@ -121,8 +157,19 @@ void sender(const std::string& recv_address_)
       // Output Stats every second
       if (timer.is_it_time_yet())
       {
-        Logger::Info("Streaming Rate", sent_bytes_per_second / 1000.f, "KB/s");
-        sent_bytes_per_second = 0;
+        const BatchedSocket::Stats stats = batched_socket.take_stats();
+        Logger::Info("Streaming Rate",
+                     stats.bytes / 1000.f,
+                     "KB/s,",
+                     frames_per_second,
+                     "frames,",
+                     stats.datagrams,
+                     "datagrams in",
+                     stats.syscalls,
+                     "syscalls,",
+                     static_cast<float>(stats.datagrams) / std::max<int64_t>(stats.syscalls, 1),
+                     "per syscall");
+        frames_per_second = 0;
       }
 
       // Press  ESC on keyboard to  exit
@@ -173,6 +220,35 @@ int main(int argc, char* argv[])
     recv_address = argv[1];
   }
 
-  sender(recv_address);
+  bool offload = false;
+  Fec fec;
+  for (int i = 2; i < argc; ++i)
+  {
+    const std::string arg = argv[i];
+    if (arg == "--offload")
+    {
+      // Let the kernel split the frames into parts
+      offload = true;
+    }
+    else if (arg == "--fec" && i + 1 < argc)
+    {
+      // <group>:<parity>, e.g. 10:2 for 2 parity parts every 10 parts
+      int group = 0;
+      int parity = 0;
+      if (std::sscanf(argv[++i], "%d:%d", &group, &parity) != 2 || group <= 0 || parity <= 0 ||
+          parity > group)
+      {
+        Logger::Error("Invalid --fec, expected <group>:<parity>", argv[i]);
+        return 1;
+      }
+      fec = Fec{static_cast<int16_t>(group), static_cast<int16_t>(parity)};
+    }
+    else
+    {
+      Logger::Warning("Unknown argument", arg);
+    }
+  }
+
+  sender(recv_address, offload, fec);
   return 0;
 }
@@ -4,12 +4,14 @@
 
 #include "control_block.h"
 #include "file_descriptor.h"
+#include "mapped_memory.h"
 #include "message_header.h"
 #include "queue_reader.h"
 #include "queue_writer.h"
 #include "simple_parser.hpp"
 
 #include <algorithm>
+#include <chrono>
 #include <csignal>
 #include <cstddef>
 #include <cstdint>
@@ -27,6 +29,107 @@ void signal_handler(int)
   Logger::Info("Exiting...");
   exit(0);
 }
+
+/**
+ * @brief Fills and drains the queue from a single thread, so that the time is
+ * dominated by walking the ring, and therefore by TLB misses, rather than by
+ * the cache lines bouncing between reader and writer.
+ *
+ * @return the average nanoseconds to write and read back a message.
+ */
+double measure_ring_walk(const std::string& queue_filepath,
+                         const std::string& control_block_file,
+                         size_t queue_size,
+                         int num_laps)
+{
+  std::filesystem::remove(queue_filepath);
+  std::filesystem::remove(control_block_file);
+  {
+    file_descriptor queue_file(queue_filepath, queue_size);
+  }
+
+  double ns_per_message{};
+  {
+    queue_writer writer = queue_writer::queue_factory(queue_filepath, control_block_file);
+    queue_reader reader = queue_reader::queue_factory(queue_filepath, control_block_file);
+
+    const std::string message_base(256, 'A');
+    size_t num_messages{};
+    uint32_t message_size = 16;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (int lap = 0; lap < num_laps; ++lap)
+    {
+      while (true)
+      {
+        // Vary the size so that messages land all over the pages
+        message_size = message_size * 7 % message_base.size() + 1;
+        const size_t total_message_size = sizeof(message_header) + message_size;
+        queue_writer::mutable_view buffer = writer.get_buffer(total_message_size);
+        if (!buffer)
+        {
+          break;
+        }
+        const message_header header{1, message_size, 0};
+        std::memcpy(buffer.data(), &header, sizeof(header));
+        std::memcpy(buffer.data() + sizeof(header), message_base.data(), message_size);
+        writer.push(total_message_size);
+        num_messages++;
+      }
+
+      while (const queue_reader::const_view header_buffer =
+                 reader.get_buffer(sizeof(message_header)))
+      {
+        const message_header* const header =
+            reinterpret_cast<const message_header*>(header_buffer.data());
+        const queue_reader::const_view message_buffer = reader.get_buffer(header->size);
+        assert(message_buffer);
+        assert(message_buffer.data()[header->size - 1] == 'A');
+        reader.pop(header_buffer.size() + message_buffer.size());
+      }
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    ns_per_message =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() /
+        static_cast<double>(num_messages);
+  }
+
+  std::filesystem::remove(queue_filepath);
+  std::filesystem::remove(control_block_file);
+  return ns_per_message;
+}
+
+/**
+ * @brief Compares the same ring backed by small pages and by huge pages.
+ */
+int run_tlb_benchmark(const simple_parser& args)
+{
+  const std::string huge_queue_filepath = args.get_value("huge_queue_file");
+  const size_t queue_size = args.get_value<int>("benchmark_queue_size_mb") * 1024 * 1024;
+  const int num_laps = args.get_value<int>("benchmark_laps");
+
+  const double small_pages_ns =
+      measure_ring_walk("tlb_queue.bin", "tlb_control_block.bin", queue_size, num_laps);
+  Logger::Info("4K pages:", small_pages_ns, "ns per message");
+
+  const std::filesystem::path huge_dir = std::filesystem::path(huge_queue_filepath).parent_path();
+  const size_t huge_page_size = mapped_memory::page_size_of(huge_dir);
+  if (huge_page_size == static_cast<size_t>(getpagesize()))
+  {
+    Logger::Error(huge_dir.string(), "is not a hugetlbfs mount point, cannot compare.");
+    return 1;
+  }
+  if (queue_size % huge_page_size)
+  {
+    Logger::Error("The queue size must be a multiple of the huge page size", huge_page_size);
+    return 1;
+  }
+
+  const double huge_pages_ns =
+      measure_ring_walk(huge_queue_filepath, "tlb_control_block.bin", queue_size, num_laps);
+  Logger::Info(huge_page_size / 1024, "KB pages:", huge_pages_ns, "ns per message");
+  return 0;
+}
 } // namespace
 
 int main(int argc, const char* const argv[])
@@ -36,12 +139,25 @@ int main(int argc, const char* const argv[])
   args.add_default("queue_file", "queue.bin");
   args.add_default("control_block_file", "control_block.bin");
   args.add_default("num_messages", 100'000);
+  // Sleep on a futex when there is nothing to read, instead of burning the core
+  args.add_default("sleep_when_idle", false);
+  // Instead of reading from the writer, compare the ring on small and huge pages
+  args.add_default("tlb_benchmark", false);
+  args.add_default("huge_queue_file", "/dev/hugepages/queue.bin");
+  args.add_default("benchmark_queue_size_mb", 64);
+  args.add_default("benchmark_laps", 20);
 
   args.parse(argc, argv);
 
+  if (args.get_value<bool>("tlb_benchmark"))
+  {
+    return run_tlb_benchmark(args);
+  }
+
   const std::string queue_filepath = args.get_value("queue_file");
   const std::string control_block_file = args.get_value("control_block_file");
   const int num_messages = args.get_value<int>("num_messages");
+  const bool sleep_when_idle = args.get_value<bool>("sleep_when_idle");
 
   {
     // This will create the queue if it wasn't there, and adjust its size
@@ -49,7 +165,10 @@ int main(int argc, const char* const argv[])
     file_descriptor queue_file(queue_filepath, queue_size);
   }
 
-  queue_reader reader = queue_reader::queue_factory(queue_filepath, control_block_file);
+  queue_reader reader =
+      sleep_when_idle ?
+          queue_reader::queue_factory(queue_filepath, control_block_file, wait_strategy{}) :
+          queue_reader::queue_factory(queue_filepath, control_block_file);
 
   signal(SIGINT, signal_handler);
 
@@ -64,7 +183,9 @@ int main(int argc, const char* const argv[])
 
     while (true)
     {
-      const queue_reader::const_view header_buffer = reader.get_buffer(sizeof(message_header));
+      const queue_reader::const_view header_buffer =
+          sleep_when_idle ? reader.wait_buffer(sizeof(message_header)) :
+                            reader.get_buffer(sizeof(message_header));
       if (header_buffer)
       {
         const message_header* const header =
@@ -30,11 +30,14 @@ int main(int argc, const char* const argv[])
 
   args.add_default("queue_file", "queue.bin");
   args.add_default("control_block_file", "control_block.bin");
+  // Must match the reader's, so that the writer knows it has to wake it up
+  args.add_default("sleep_when_idle", false);
 
   args.parse(argc, argv);
 
   const std::string queue_filepath = args.get_value("queue_file");
   const std::string control_block_file = args.get_value("control_block_file");
+  const bool sleep_when_idle = args.get_value<bool>("sleep_when_idle");
 
   {
     // This will create the queue, which could in principle already be there,
@@ -46,7 +49,10 @@ int main(int argc, const char* const argv[])
     file_descriptor queue_file(queue_filepath, queue_size);
   }
 
-  queue_writer writer = queue_writer::queue_factory(queue_filepath, control_block_file);
+  queue_writer writer =
+      sleep_when_idle ?
+          queue_writer::queue_factory(queue_filepath, control_block_file, wait_strategy{}) :
+          queue_writer::queue_factory(queue_filepath, control_block_file);
 
   signal(SIGINT, signal_handler);
 
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "control_block.h"
+#include "mapped_memory.h"
+#include "queue_base.h"
+
+/**
+ * @brief The broadcast reader consumes a queue written by a broadcast_writer.
+ * Up to broadcast_control_block::max_readers readers can be attached to the
+ * same queue, each with its own cursor. On construction the reader claims a
+ * free slot in the control block, and it starts receiving the messages pushed
+ * after the writer has noticed it. The slot is released on destruction: mind
+ * that a reader process that dies without unwinding keeps its slot, and a
+ * blocking writer will wait for it forever.
+ */
+class broadcast_reader : public detail::queue_base<broadcast_reader, broadcast_control_block>
+{
+public:
+  struct const_view
+  {
+    explicit operator bool() const { return _ptr; }
+    size_t size() const { return _len; }
+    const char* data() const { return _ptr; }
+
+  private:
+    const_view(const char* ptr, size_t size) : _ptr(ptr), _len(size) {}
+    friend broadcast_reader;
+    const char* _ptr;
+    const size_t _len;
+  };
+
+  broadcast_reader(broadcast_reader&& other) noexcept;
+  broadcast_reader& operator=(broadcast_reader&&) = delete;
+
+  ~broadcast_reader();
+
+  /**
+   * @brief get_buffer checks if there are "bytes_to_read" avaiable to read in
+   * the queue and returns a const view to the message. The returned value has
+   * to be checked if "falsy" in case there are not "bytes_to_read" to read.
+   * If the writer overwrote messages this reader had not read yet, the reader
+   * skips to the latest message and the lost bytes are added to
+   * dropped_bytes(). If that happens in the middle of a message, i.e. with
+   * views returned since the last pop, lapped() becomes true and the view is
+   * falsy until pop is called.
+   *
+   * @param bytes_to_read: the number of bytes to read.
+   */
+  const_view get_buffer(size_t bytes_to_read);
+
+  /**
+   * @brief After calling get_buffer and having used the view to read the
+   * message from it, the user *has* to call pop to advance the reader cursor.
+   *
+   * @return false if the writer is using overflow_policy::overwrite_oldest and
+   * overwrote the bytes while they were being read. In that case the views
+   * returned since the last pop must be discarded, and the reader has already
+   * skipped to the latest message.
+   */
+  bool pop(size_t bytes_to_pop);
+
+  /**
+   * @brief Whether the writer overwrote the message being read, see
+   * get_buffer. A reader waiting for the rest of a message has to check it
+   * when get_buffer fails, and then call pop to start over.
+   */
+  bool lapped() const { return _lapped; }
+
+  /**
+   * @brief Total number of bytes lost because the writer overwrote them.
+   */
+  uint64_t dropped_bytes() const { return _dropped_bytes; }
+
+private:
+  broadcast_reader(mapped_memory&& control_block_region,
+                   mapped_memory&& first_mapping,
+                   mapped_memory&& second_mapping,
+                   size_t size);
+
+  friend queue_base<broadcast_reader, broadcast_control_block>;
+
+  const char* get_reader_ptr(size_t bytes_to_read);
+
+  /**
+   * @brief Moves the cursor to the latest published message, dropping
+   * everything in between.
+   */
+  void skip_to_latest(uint64_t read_position);
+
+private:
+  broadcast_control_block& _header;
+  mapped_memory _control_block_region;
+  mapped_memory _first_mapping;
+  mapped_memory _second_mapping;
+  const size_t _size;
+  broadcast_control_block::reader_cursor* _cursor{};
+  bool _active{};
+  size_t _uncommitted_reads{};
+  bool _lapped{};
+  uint64_t _dropped_bytes{};
+};
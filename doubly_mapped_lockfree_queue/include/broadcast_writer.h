@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "control_block.h"
+#include "mapped_memory.h"
+#include "queue_base.h"
+
+/**
+ * @brief The broadcast writer publishes into a shared memory queue that many
+ * broadcast_readers can consume at the same time. Every message is written
+ * once and every registered reader sees it, so there is no copy per consumer.
+ * With overflow_policy::block_on_slowest_reader get_buffer fails when the
+ * slowest registered reader has not freed enough space yet; with
+ * overflow_policy::overwrite_oldest the writer never waits and readers that
+ * fall behind by more than the ring size lose messages.
+ * Only one writer can write on the same queue at the same time.
+ */
+class broadcast_writer : public detail::queue_base<broadcast_writer, broadcast_control_block>
+{
+public:
+  struct mutable_view
+  {
+    explicit operator bool() const { return _ptr; }
+    size_t size() const { return _len; }
+    char* data() { return _ptr; }
+
+  private:
+    mutable_view(char* ptr, size_t size) : _ptr(ptr), _len(size) {}
+    friend broadcast_writer;
+    char* _ptr;
+    const size_t _len;
+  };
+
+  /**
+   * @brief get_buffer checks if there are "bytes_to_write" avaiable to write in
+   * the queue and returns a mutable view to the message. The returned view has
+   * to be checked if "falsy" in case there are not "bytes_to_write" to write.
+   *
+   * @param bytes_to_write: the number of bytes to write.
+   */
+  mutable_view get_buffer(size_t bytes_to_write);
+
+  /**
+   * @brief After calling get_buffer and having used the buffer to copy the
+   * message into it, the user *has* to call push to publish it to all the
+   * readers.
+   *
+   * @param bytes_to_push: same semantic as queue_writer::push.
+   */
+  void push(size_t bytes_to_push);
+
+private:
+  broadcast_writer(mapped_memory&& control_block_region,
+                   mapped_memory&& first_mapping,
+                   mapped_memory&& second_mapping,
+                   size_t size,
+                   overflow_policy policy = overflow_policy::block_on_slowest_reader);
+
+  friend queue_base<broadcast_writer, broadcast_control_block>;
+
+  char* get_writer_ptr(size_t bytes_to_write);
+
+  /**
+   * @brief Activates the readers that registered since the last call, making
+   * them start from the current write position.
+   */
+  void accept_readers();
+
+  uint64_t slowest_reader_position(uint64_t write_position) const;
+
+private:
+  broadcast_control_block& _header;
+  mapped_memory _control_block_region;
+  mapped_memory _first_mapping;
+  mapped_memory _second_mapping;
+  const size_t _size;
+  const overflow_policy _policy;
+  size_t _uncommitted_writes{};
+  // A lower bound of every reader position. We only rescan the readers
+  // cursors once the writer catches up with it.
+  uint64_t _slowest_reader_position{};
+};
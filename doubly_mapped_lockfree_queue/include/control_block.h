@@ -1,6 +1,8 @@
 #pragma once
 
 #include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <new>
 
 #ifdef __cpp_lib_hardware_interference_size
@@ -21,4 +23,61 @@ struct control_block
   alignas(hardware_destructive_interference_size) std::atomic<uint64_t> version;
   std::atomic<uint64_t> next_read_offset;
   alignas(hardware_destructive_interference_size) std::atomic<uint64_t> next_write_offset;
+  // Only used by mpsc_writer: the end of the space reserved so far by all
+  // the writers. next_write_offset trails it as reservations are committed.
+  alignas(hardware_destructive_interference_size) std::atomic<uint64_t> next_reserve_offset;
+  // Futex words of the optional wait_strategy: non zero while the reader
+  // (resp. the writer) is asleep waiting for the other side. They are only
+  // written when someone goes to sleep, so this line is almost always clean.
+  alignas(hardware_destructive_interference_size) std::atomic<uint32_t> reader_parked;
+  std::atomic<uint32_t> writer_parked;
+};
+
+/**
+ * @brief What the broadcast writer does when the slowest reader has not yet
+ * consumed the space it needs.
+ */
+enum class overflow_policy : uint32_t
+{
+  block_on_slowest_reader = 0,
+  overwrite_oldest = 1,
+};
+
+/**
+ * @brief This is the control block of the broadcast queue (one writer, many
+ * readers). Unlike control_block it stores monotonic byte positions instead of
+ * offsets: the offset in the ring is position % size, and a reader can tell
+ * it has been lapped by the writer when next_write_position - its position
+ * is bigger than the ring size.
+ * Every reader cursor sits on its own cache line, so readers never contend
+ * with one another and the writer only touches them when it runs out of room.
+ */
+struct broadcast_control_block
+{
+  static constexpr size_t max_readers = 16;
+
+  enum reader_state : uint32_t
+  {
+    unused = 0,
+    registering = 1,
+    active = 2,
+  };
+
+  struct alignas(hardware_destructive_interference_size) reader_cursor
+  {
+    std::atomic<uint64_t> next_read_position;
+    std::atomic<uint32_t> state;
+  };
+
+  alignas(hardware_destructive_interference_size) std::atomic<uint64_t> version;
+  std::atomic<overflow_policy> policy;
+  // Readers claim a slot and bump this, the writer then activates them at its
+  // current write position. This way the writer never misses a new reader.
+  std::atomic<uint32_t> pending_registrations;
+  alignas(hardware_destructive_interference_size) std::atomic<uint64_t> next_write_position;
+  // Only used with overflow_policy::overwrite_oldest: the end of the region
+  // the writer may currently be overwriting. Readers check it after reading
+  // to know if what they read was clobbered under their feet.
+  std::atomic<uint64_t> write_reserve_position;
+  reader_cursor readers[max_readers];
 };
@@ -5,6 +5,7 @@
 #include <string>
 
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 class file_descriptor
@@ -21,17 +22,69 @@ public:
                                ". Error: " + std::to_string(errno));
     }
 
-    if (::ftruncate(_fd, expected_size) != 0)
+    try
     {
-      throw std::runtime_error("cannot resize file: " + filepath + " to expected size " +
-                               std::to_string(expected_size) + ". Error: " + std::to_string(errno));
+      resize(_fd, filepath, expected_size);
+    }
+    catch (...)
+    {
+      // The destructor won't run
+      close(_fd);
+      throw;
     }
   }
 
+  /**
+   * @brief Takes ownership of an already open file descriptor, e.g. one
+   * received from another process.
+   */
+  explicit file_descriptor(int fd) : _fd(fd) {}
+
+  /**
+   * @brief Creates an anonymous file that only lives in memory, so it is
+   * never written back to disk. It goes away once every descriptor and
+   * mapping of it are closed.
+   *
+   * @param memfd_flags: extra memfd_create flags, e.g. MFD_HUGETLB.
+   */
+  static file_descriptor memfd(const std::string& name, size_t expected_size, int memfd_flags = 0)
+  {
+    file_descriptor file(::memfd_create(name.c_str(), MFD_CLOEXEC | memfd_flags));
+    if (file._fd == -1)
+    {
+      throw std::runtime_error("Could not create memfd: " + name +
+                               ". Error: " + std::to_string(errno));
+    }
+
+    resize(file._fd, name, expected_size);
+    return file;
+  }
+
+  file_descriptor(const file_descriptor&) = delete;
+  file_descriptor& operator=(const file_descriptor&) = delete;
+
+  file_descriptor(file_descriptor&& other) noexcept : _fd(other._fd) { other._fd = -1; }
+  file_descriptor& operator=(file_descriptor&&) = delete;
+
   int fd() const { return _fd; }
 
-  ~file_descriptor() { close(_fd); }
+  ~file_descriptor()
+  {
+    if (_fd != -1)
+    {
+      close(_fd);
+    }
+  }
 
 private:
-  const int _fd{};
-};
\ No newline at end of file
+  static void resize(int fd, const std::string& filepath, size_t expected_size)
+  {
+    if (::ftruncate(fd, expected_size) != 0)
+    {
+      throw std::runtime_error("cannot resize file: " + filepath + " to expected size " +
+                               std::to_string(expected_size) + ". Error: " + std::to_string(errno));
+    }
+  }
+
+  int _fd{-1};
+};
@@ -9,7 +9,8 @@
 
 /**
  * @brief We use this class to abstract the mmap functions in a nice RAII way.
- * The destructor will call munmap.
+ * The destructor will call munmap, and msync first only if asked to with
+ * set_sync_on_destruction.
  */
 class mapped_memory
 {
@@ -19,6 +20,15 @@ public:
                 void* start_addr = nullptr,
                 size_t offset = 0);
 
+  /**
+   * @brief Maps an already open file. The file can be closed afterwards, the
+   * mapping keeps it alive.
+   */
+  mapped_memory(const file_descriptor& file,
+                size_t expected_size,
+                void* start_addr = nullptr,
+                size_t offset = 0);
+
   mapped_memory(size_t expected_size, void* start_addr = nullptr, size_t offset = 0);
 
   mapped_memory(const mapped_memory&) = delete;
@@ -48,6 +58,22 @@ public:
     assert(err == 0);
   }
 
+  /**
+   * @brief The size of the pages backing "filename": the huge page size if the
+   * file is on hugetlbfs, getpagesize() otherwise.
+   */
+  static size_t page_size_of(const std::string& filename);
+
+  static size_t page_size_of(const file_descriptor& file);
+
+  /**
+   * @brief If true the destructor will synchronously flush the region to the
+   * file before unmapping it. It's off by default: nothing is lost if we
+   * don't, the kernel writes back the dirty pages on its own, and for big
+   * rings the synchronous flush can stall the teardown for a long time.
+   */
+  void set_sync_on_destruction(bool sync) { _sync_on_destruction = sync; }
+
   template <typename ControlBlock>
   ControlBlock& get_header()
   {
@@ -73,9 +99,10 @@ public:
 private:
   static void* map_memory(size_t expected_size,
                           void* start_addr = nullptr,
-                          int fd = 0,
+                          int fd = -1,
                           size_t offset = 0);
 
   void* _mapped_region{};
   size_t _length{};
+  bool _sync_on_destruction{};
 };
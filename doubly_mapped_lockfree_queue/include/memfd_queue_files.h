@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+
+#include "control_block.h"
+#include "file_descriptor.h"
+
+/**
+ * @brief The two files a queue is made of, created with memfd_create so that
+ * they only live in memory and nothing is ever written back to disk. One
+ * process creates them and sends them to its peer over a connected unix
+ * socket, then both pass them to queue_factory.
+ *
+ *   // Writer process
+ *   memfd_queue_files files = memfd_queue_files::create(queue_size);
+ *   files.send(socket);
+ *   queue_writer writer = queue_writer::queue_factory(files);
+ *
+ *   // Reader process
+ *   queue_reader reader = queue_reader::queue_factory(memfd_queue_files::receive(socket));
+ */
+struct memfd_queue_files
+{
+  /**
+   * @param memfd_flags: extra memfd_create flags for the queue, e.g.
+   * MFD_HUGETLB to back it with huge pages.
+   */
+  static memfd_queue_files create(size_t queue_size,
+                                  size_t control_block_size = sizeof(control_block),
+                                  int memfd_flags = 0);
+
+  /**
+   * @brief Blocks until the peer sends the files over the unix socket.
+   * @throw std::runtime_error if the peer closed the socket or sent something else.
+   */
+  static memfd_queue_files receive(int unix_socket);
+
+  /**
+   * @brief Sends both descriptors to the peer (SCM_RIGHTS).
+   */
+  void send(int unix_socket) const;
+
+  file_descriptor queue;
+  file_descriptor control_block;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "control_block.h"
+#include "mapped_memory.h"
+#include "queue_base.h"
+
+/**
+ * @brief The mpsc writer lets many processes write concurrently into the same
+ * shared memory queue, which is then consumed by a single queue_reader.
+ * Writers reserve their space on the shared next_reserve_offset and publish it
+ * on next_write_offset strictly in reservation order, so the reader never sees
+ * a message that is not completely written.
+ * Mind that a writer holding a reservation delays the commit of all the
+ * writers that reserved after it, so keep the time between get_buffer and
+ * push short. Do not mix mpsc_writer and queue_writer on the same queue.
+ */
+class mpsc_writer : public detail::queue_base<mpsc_writer>
+{
+public:
+  struct mutable_view
+  {
+    explicit operator bool() const { return _ptr; }
+    size_t size() const { return _len; }
+    char* data() { return _ptr; }
+
+  private:
+    mutable_view(char* ptr, size_t size) : _ptr(ptr), _len(size) {}
+    friend mpsc_writer;
+    char* _ptr;
+    const size_t _len;
+  };
+
+  /**
+   * @brief get_buffer reserves "bytes_to_write" in the queue for this writer
+   * and returns a mutable view to it. The returned view has to be checked if
+   * "falsy" in case there is not enough space.
+   * Unlike queue_writer, a writer can only hold one reservation at a time, so
+   * get_buffer cannot be called again before push.
+   *
+   * @param bytes_to_write: the number of bytes to write.
+   */
+  mutable_view get_buffer(size_t bytes_to_write);
+
+  /**
+   * @brief Publishes the reservation made with get_buffer. It waits for all the
+   * writers that reserved earlier to publish first.
+   *
+   * @param bytes_to_push: must match what was reserved with get_buffer.
+   */
+  void push(size_t bytes_to_push);
+
+private:
+  mpsc_writer(mapped_memory&& control_block_region,
+              mapped_memory&& first_mapping,
+              mapped_memory&& second_mapping,
+              size_t size);
+
+  friend queue_base<mpsc_writer>;
+
+  char* get_writer_ptr(size_t bytes_to_write);
+
+  uint64_t advance(uint64_t offset, size_t bytes) const;
+
+private:
+  control_block& _header;
+  mapped_memory _control_block_region;
+  mapped_memory _first_mapping;
+  mapped_memory _second_mapping;
+  const size_t _size;
+  uint64_t _reserved_offset{};
+  size_t _reserved_bytes{};
+};
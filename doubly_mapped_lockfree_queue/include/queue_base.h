@@ -7,10 +7,14 @@
 #include <stdexcept>
 #include <string>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include <utility>
 
 #include "control_block.h"
+#include "file_descriptor.h"
 #include "mapped_memory.h"
+#include "memfd_queue_files.h"
 
 namespace detail
 {
@@ -20,37 +24,111 @@ namespace detail
  * queue_reader and writer. This is part of the implementation and should not
  * be instantiated by the user.
  */
-template <typename Derived>
+template <typename Derived, typename ControlBlock = control_block>
 class queue_base
 {
 public:
+  /**
+   * @brief Builds the double mapping of queue_filename and maps the control
+   * block. Any extra argument is forwarded to the Derived constructor.
+   */
+  template <typename... Args>
   static Derived queue_factory(const std::string& queue_filename,
-                               const std::string& control_block_filename)
+                               const std::string& control_block_filename,
+                               Args&&... args)
   {
     const size_t size = std::filesystem::file_size(queue_filename);
+    file_descriptor queue_file(queue_filename, size);
+    file_descriptor control_block_file(control_block_filename, sizeof(ControlBlock));
+
+    return queue_factory(queue_file, control_block_file, std::forward<Args>(args)...);
+  }
+
+  /**
+   * @brief Same as above, for files that are already open. The descriptors
+   * can be closed as soon as this returns.
+   */
+  template <typename... Args>
+  static Derived queue_factory(const file_descriptor& queue_file,
+                               const file_descriptor& control_block_file,
+                               Args&&... args)
+  {
+    struct stat queue_file_info = {};
+    if (::fstat(queue_file.fd(), &queue_file_info) != 0)
+    {
+      throw std::runtime_error("cannot stat the queue file. Error: " + std::to_string(errno));
+    }
+    const size_t size = queue_file_info.st_size;
     assert(size);
 
+    // Files on hugetlbfs can only be mapped at huge page boundaries, so the
+    // whole trick has to be done at the page size of the queue file.
+    const size_t page_size = mapped_memory::page_size_of(queue_file);
+
+    auto [first_mapping, second_mapping] = double_map(queue_file, size, page_size);
+
+    mapped_memory control_block_region(control_block_file, sizeof(ControlBlock));
+    return Derived(std::move(control_block_region),
+                   std::move(first_mapping),
+                   std::move(second_mapping),
+                   size,
+                   std::forward<Args>(args)...);
+  }
+
+  /**
+   * @brief Maps a queue living in memory only, see memfd_queue_files.
+   */
+  template <typename... Args>
+  static Derived queue_factory(const memfd_queue_files& files, Args&&... args)
+  {
+    return queue_factory(files.queue, files.control_block, std::forward<Args>(args)...);
+  }
+
+  /**
+   * @brief Maps "size" bytes of the file twice, back to back, with the first
+   * mapping aligned to page_size.
+   */
+  static std::pair<mapped_memory, mapped_memory>
+  double_map(const file_descriptor& file, size_t size, size_t page_size)
+  {
     // Check that the size is a multiple of the page_size, this will allow
     // us to map in nicely
-    [[maybe_unused]] const size_t page_size = getpagesize();
     assert(!(size % page_size));
 
-    // Let's reserve the space before we mmap the buffer twice.
-    mapped_memory double_mapping(2 * size);
+    // Let's reserve the space before we mmap the buffer twice. mmap only
+    // guarantees the alignment of the small pages, so for bigger pages we
+    // reserve one more and then align the start ourselves.
+    const size_t small_page_size = getpagesize();
+    const size_t reserved_size = 2 * size + (page_size - small_page_size);
+    mapped_memory double_mapping(reserved_size);
+
+    char* const reserved_begin = double_mapping.get_address();
+    char* const begin = reinterpret_cast<char*>(
+        (reinterpret_cast<std::uintptr_t>(reserved_begin) + page_size - 1) / page_size *
+        page_size);
 
     // Now we do the mapping of the same file twice in the contiguous region
     // we reserved. This will invalidate the previous mapping btw.
-    mapped_memory first_mapping(queue_filename, size, double_mapping.get_address());
-    assert(double_mapping.get_address() == first_mapping.get_address());
+    mapped_memory first_mapping(file, size, begin);
+    assert(begin == first_mapping.get_address());
     assert(first_mapping.get_length() == size);
     mapped_memory second_mapping(
-        queue_filename, size, first_mapping.get_address() + first_mapping.get_length());
+        file, size, first_mapping.get_address() + first_mapping.get_length());
 
     double_mapping.release();
 
-    mapped_memory control_block_region(control_block_filename, sizeof(control_block));
-    return Derived(
-        std::move(control_block_region), std::move(first_mapping), std::move(second_mapping), size);
+    // Give back what we reserved only for the alignment
+    if (begin != reserved_begin)
+    {
+      ::munmap(reserved_begin, begin - reserved_begin);
+    }
+    char* const end = begin + 2 * size;
+    if (end != reserved_begin + reserved_size)
+    {
+      ::munmap(end, reserved_begin + reserved_size - end);
+    }
+
+    return {std::move(first_mapping), std::move(second_mapping)};
   }
 
 protected:
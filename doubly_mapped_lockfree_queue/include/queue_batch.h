@@ -0,0 +1,95 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+/**
+ * @brief Commits messages on a queue_writer or queue_reader and publishes them
+ * to the other side only once every "max_messages", or once "max_delay" has
+ * passed since the first unpublished message, whatever comes first. Whatever
+ * is left is published on destruction.
+ *
+ * There is no timer behind "max_delay": the clock is only looked at by commit()
+ * and poll(), so when there is nothing to commit call poll() (or publish())
+ * from the idle loop, or the last messages wait for the next one.
+ *
+ *   queue_batch batch(writer, 32, std::chrono::microseconds(10));
+ *   while (...)
+ *   {
+ *     queue_writer::mutable_view buffer = writer.get_buffer(size);
+ *     if (!buffer)
+ *     {
+ *       batch.poll();
+ *       continue;
+ *     }
+ *     ...
+ *     batch.commit(size); // instead of writer.push(size)
+ *   }
+ *
+ * Mind that the peer does not see anything (and a reader does not give back
+ * any space) until the batch is published, so keep the delay short. wait_buffer
+ * publishes what was committed before it waits.
+ */
+template <typename Queue>
+class queue_batch
+{
+public:
+  explicit queue_batch(Queue& queue,
+                       size_t max_messages,
+                       std::chrono::nanoseconds max_delay = std::chrono::nanoseconds::zero())
+      : _queue(queue), _max_messages(max_messages), _max_delay(max_delay)
+  {
+  }
+
+  queue_batch(const queue_batch&) = delete;
+  queue_batch& operator=(const queue_batch&) = delete;
+
+  ~queue_batch() { publish(); }
+
+  void commit(size_t bytes_to_commit)
+  {
+    _queue.commit(bytes_to_commit);
+
+    // Only look at the clock if we have a time budget
+    const bool has_delay = _max_delay != std::chrono::nanoseconds::zero();
+    if (has_delay && !_unpublished_messages)
+    {
+      _first_unpublished = std::chrono::steady_clock::now();
+    }
+
+    if (++_unpublished_messages >= _max_messages ||
+        (has_delay && std::chrono::steady_clock::now() - _first_unpublished >= _max_delay))
+    {
+      publish();
+    }
+  }
+
+  /**
+   * @brief Publishes if "max_delay" has passed since the first unpublished
+   * message. Meant for when there is nothing to commit.
+   */
+  void poll()
+  {
+    if (_unpublished_messages && _max_delay != std::chrono::nanoseconds::zero() &&
+        std::chrono::steady_clock::now() - _first_unpublished >= _max_delay)
+    {
+      publish();
+    }
+  }
+
+  void publish()
+  {
+    if (_unpublished_messages)
+    {
+      _queue.publish();
+      _unpublished_messages = 0;
+    }
+  }
+
+private:
+  Queue& _queue;
+  const size_t _max_messages;
+  const std::chrono::nanoseconds _max_delay;
+  size_t _unpublished_messages{};
+  std::chrono::steady_clock::time_point _first_unpublished{};
+};
@@ -6,6 +6,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <filesystem>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <sys/mman.h>
@@ -15,6 +16,7 @@
 #include "file_descriptor.h"
 #include "mapped_memory.h"
 #include "queue_base.h"
+#include "wait_strategy.h"
 
 /**
  * @brief The queue reader accesses the shared memory queue. It can be used
@@ -58,16 +60,44 @@ public:
    */
   void pop(size_t bytes_to_pop);
 
+  /**
+   * @brief Like pop, but the space is not given back to the writer until the
+   * next publish. Publishing is what makes the writer's core pull our cache
+   * line over, so for small messages it pays to do it once per batch (see
+   * queue_batch).
+   */
+  void commit(size_t bytes_to_commit);
+
+  /**
+   * @brief Gives back to the writer all the bytes committed so far.
+   */
+  void publish();
+
+  /**
+   * @brief Like get_buffer, but if there are not "bytes_to_read" yet it waits
+   * for the writer, following the wait_strategy the reader was built with.
+   * Before waiting it publishes whatever was committed, so that a batch can't
+   * hold back the space the writer may be waiting on. Only available if the
+   * reader was built with a wait_strategy.
+   *
+   * @param bytes_to_read: the number of bytes to read. Together with the bytes
+   * got and not committed yet, less than the queue size.
+   */
+  const_view wait_buffer(size_t bytes_to_read);
+
 private:
   queue_reader(mapped_memory&& control_block_region,
                mapped_memory&& first_mapping,
                mapped_memory&& second_mapping,
-               size_t size);
+               size_t size,
+               std::optional<wait_strategy> strategy = std::nullopt);
 
   friend queue_base<queue_reader>;
 
   const char* get_reader_ptr(size_t bytes_to_read);
 
+  size_t readable_bytes(uint64_t next_write_offset) const;
+
 private:
   control_block& _header;
   mapped_memory _control_block_region;
@@ -75,4 +105,10 @@ private:
   mapped_memory _second_mapping;
   const size_t _size;
   size_t _uncommitted_reads{};
+  const std::optional<wait_strategy> _wait_strategy;
+  // Local copy of next_read_offset including the unpublished commits. We are
+  // the only one writing it, so no need to read it back from the header.
+  uint64_t _read_offset{};
+  // Last seen next_write_offset, only refreshed when it says we are empty.
+  uint64_t _cached_next_write_offset{};
 };
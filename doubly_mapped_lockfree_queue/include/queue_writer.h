@@ -1,8 +1,10 @@
 #pragma once
 
 #include "queue_base.h"
+#include "wait_strategy.h"
 #include <atomic>
 #include <cstdint>
+#include <optional>
 
 /**
  * @brief The queue writer accesses the shared memory queue. It can be used
@@ -46,13 +48,48 @@ public:
    */
   void push(size_t bytes_to_push);
 
+  /**
+   * @brief Like push, but the bytes are not visible to the reader until the
+   * next publish. Publishing is what makes the reader's core pull our cache
+   * line over, so for small messages it pays to do it once per batch (see
+   * queue_batch).
+   */
+  void commit(size_t bytes_to_commit);
+
+  /**
+   * @brief Makes all the bytes committed so far visible to the reader.
+   */
+  void publish();
+
+  /**
+   * @brief Like get_buffer, but if there is not enough space it waits for the
+   * reader to free it, following the wait_strategy the writer was built with.
+   * Before waiting it publishes whatever was committed, so that a batch can't
+   * hold back the reader we are waiting on. Only available if the writer was
+   * built with a wait_strategy.
+   *
+   * @param bytes_to_write: the number of bytes to write. Together with the bytes
+   * got and not committed yet, less than the queue size.
+   */
+  mutable_view wait_buffer(size_t bytes_to_write);
+
+  /**
+   * @brief If true the queue and the control block are flushed to their files
+   * when the writer is destroyed. Off by default, as it can stall the teardown
+   * of big rings and it's pointless for in-memory queues.
+   */
+  void set_sync_on_destruction(bool sync);
+
 private:
   char* get_writer_ptr(size_t bytes_to_write);
 
+  size_t writable_bytes(uint64_t next_read_offset) const;
+
   queue_writer(mapped_memory&& control_block_region,
                mapped_memory&& first_mapping,
                mapped_memory&& second_mapping,
-               size_t size);
+               size_t size,
+               std::optional<wait_strategy> strategy = std::nullopt);
 
   friend queue_base<queue_writer>;
 
@@ -63,4 +100,10 @@ private:
   mapped_memory _second_mapping;
   const size_t _size;
   size_t _uncommitted_writes{};
+  const std::optional<wait_strategy> _wait_strategy;
+  // Local copy of next_write_offset including the unpublished commits. We are
+  // the only one writing it, so no need to read it back from the header.
+  uint64_t _write_offset{};
+  // Last seen next_read_offset, only refreshed when it says we are full.
+  uint64_t _cached_next_read_offset{};
 };
\ No newline at end of file
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <x86intrin.h> // _mm_pause()
+
+/**
+ * @brief How queue_reader::wait_buffer and queue_writer::wait_buffer wait for
+ * the other side: first they poll as fast as they can, then they poll with an
+ * exponential _mm_pause backoff and finally they go to sleep on a futex in
+ * the control block, until the peer wakes them up.
+ * The peer only issues the (expensive) wake up syscall when it knows someone is
+ * sleeping, but it has to be constructed with a wait_strategy too, to check for
+ * it. If it's not, the sleeper only wakes up after max_sleep.
+ */
+struct wait_strategy
+{
+  uint32_t spin_iterations{1'000};
+  uint32_t pause_iterations{1'000};
+  // Upper bound of the number of _mm_pause between two polls in the backoff.
+  uint32_t max_pauses{64};
+  std::chrono::microseconds max_sleep{std::chrono::milliseconds(100)};
+};
+
+namespace detail
+{
+
+inline void futex_wait(std::atomic<uint32_t>& word,
+                       uint32_t expected,
+                       std::chrono::microseconds timeout)
+{
+  static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t));
+  const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+  const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout - seconds);
+  const timespec ts{seconds.count(), nanoseconds.count()};
+  // Not FUTEX_PRIVATE_FLAG: the word lives in memory shared between processes.
+  // Spurious wake ups and EAGAIN are fine, the caller polls again anyway.
+  ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, &ts, nullptr, 0);
+}
+
+inline void futex_wake_all(std::atomic<uint32_t>& word)
+{
+  ::syscall(
+      SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+}
+
+/**
+ * @brief Calls try_get until it returns something truthy, waiting in between
+ * as dictated by the strategy. "parked" is the futex the peer checks to know if
+ * it has to wake us up.
+ */
+template <typename TryGet>
+auto wait_until(TryGet&& try_get, std::atomic<uint32_t>& parked, const wait_strategy& strategy)
+{
+  for (uint32_t i = 0; i < strategy.spin_iterations; ++i)
+  {
+    if (auto result = try_get())
+    {
+      return result;
+    }
+  }
+
+  uint32_t pauses = 1;
+  for (uint32_t i = 0; i < strategy.pause_iterations; ++i)
+  {
+    if (auto result = try_get())
+    {
+      return result;
+    }
+    for (uint32_t p = 0; p < pauses; ++p)
+    {
+      _mm_pause();
+    }
+    pauses = std::min(2 * pauses, strategy.max_pauses);
+  }
+
+  while (true)
+  {
+    // Announce we are going to sleep *before* the last check, otherwise the
+    // peer could publish and look at "parked" in between and we would miss
+    // its wake up. Pairs with the fence in wake_if_parked.
+    parked.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (auto result = try_get())
+    {
+      parked.store(0, std::memory_order_relaxed);
+      return result;
+    }
+
+    futex_wait(parked, 1, strategy.max_sleep);
+    parked.store(0, std::memory_order_relaxed);
+
+    if (auto result = try_get())
+    {
+      return result;
+    }
+  }
+}
+
+/**
+ * @brief To be called after publishing something the peer may be sleeping on.
+ */
+inline void wake_if_parked(std::atomic<uint32_t>& parked)
+{
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (parked.load(std::memory_order_relaxed))
+  {
+    futex_wake_all(parked);
+  }
+}
+
+} // namespace detail
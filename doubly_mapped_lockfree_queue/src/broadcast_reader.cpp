@@ -0,0 +1,166 @@
+#include "broadcast_reader.h"
+
+#include <atomic>
+#include <cassert>
+#include <stdexcept>
+
+const char* broadcast_reader::get_reader_ptr(size_t bytes_to_read)
+{
+  if (!_active)
+  {
+    // Still waiting for the writer to notice us
+    if (_cursor->state.load(std::memory_order_acquire) != broadcast_control_block::active)
+    {
+      return nullptr;
+    }
+    _active = true;
+  }
+
+  if (_lapped)
+  {
+    // Nothing to read until the caller drops the message it was reading
+    return nullptr;
+  }
+
+  if (bytes_to_read + _uncommitted_reads > _size)
+  {
+    return nullptr;
+  }
+
+  uint64_t read_position = _cursor->next_read_position.load(std::memory_order_relaxed);
+  const uint64_t write_position = _header.next_write_position.load(std::memory_order_acquire);
+
+  if (write_position - read_position > _size)
+  {
+    // We have been lapped by an overwriting writer: resync right away, and if
+    // we were in the middle of a message have pop report it.
+    _lapped = _uncommitted_reads != 0;
+    skip_to_latest(read_position);
+    if (_lapped)
+    {
+      return nullptr;
+    }
+    read_position = _cursor->next_read_position.load(std::memory_order_relaxed);
+  }
+
+  const size_t readable_bytes = write_position - read_position;
+  if (bytes_to_read + _uncommitted_reads > readable_bytes)
+  {
+    return nullptr;
+  }
+
+  const char* reader_ptr =
+      _first_mapping.get_address() + (read_position % _size) + _uncommitted_reads;
+
+  _uncommitted_reads += bytes_to_read;
+  return reader_ptr;
+}
+
+broadcast_reader::const_view broadcast_reader::get_buffer(size_t bytes_to_read)
+{
+  const char* reader_ptr = get_reader_ptr(bytes_to_read);
+  if (reader_ptr)
+  {
+    return {reader_ptr, bytes_to_read};
+  }
+  return {nullptr, 0};
+}
+
+bool broadcast_reader::pop(size_t bytes_to_pop)
+{
+  if (_lapped)
+  {
+    // get_buffer already skipped to the latest message
+    _lapped = false;
+    return false;
+  }
+
+  assert(_uncommitted_reads >= bytes_to_pop);
+  const uint64_t read_position = _cursor->next_read_position.load(std::memory_order_relaxed);
+
+  if (_header.policy.load(std::memory_order_relaxed) == overflow_policy::overwrite_oldest)
+  {
+    // Pairs with the release fence in broadcast_writer::get_writer_ptr: if we
+    // read any byte the writer overwrote, we see its reserve position too.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t reserve_position =
+        _header.write_reserve_position.load(std::memory_order_relaxed);
+    if (reserve_position - read_position > _size)
+    {
+      skip_to_latest(read_position);
+      return false;
+    }
+  }
+
+  _cursor->next_read_position.store(read_position + bytes_to_pop, std::memory_order_release);
+  _uncommitted_reads -= bytes_to_pop;
+  return true;
+}
+
+void broadcast_reader::skip_to_latest(uint64_t read_position)
+{
+  const uint64_t write_position = _header.next_write_position.load(std::memory_order_acquire);
+  _dropped_bytes += write_position - read_position;
+  _cursor->next_read_position.store(write_position, std::memory_order_release);
+  _uncommitted_reads = 0;
+}
+
+broadcast_reader::broadcast_reader(mapped_memory&& control_block_region,
+                                   mapped_memory&& first_mapping,
+                                   mapped_memory&& second_mapping,
+                                   size_t size)
+    : _header(control_block_region.get_header<broadcast_control_block>()),
+      _control_block_region(std::move(control_block_region)),
+      _first_mapping(std::move(first_mapping)),
+      _second_mapping(std::move(second_mapping)),
+      _size(size)
+{
+  for (broadcast_control_block::reader_cursor& reader : _header.readers)
+  {
+    uint32_t expected = broadcast_control_block::unused;
+    if (reader.state.compare_exchange_strong(
+            expected, broadcast_control_block::registering, std::memory_order_acq_rel))
+    {
+      _cursor = &reader;
+      _header.pending_registrations.fetch_add(1, std::memory_order_release);
+      return;
+    }
+  }
+
+  throw std::runtime_error("No free reader slot, at most " +
+                           std::to_string(broadcast_control_block::max_readers) +
+                           " readers are allowed");
+}
+
+broadcast_reader::broadcast_reader(broadcast_reader&& other) noexcept
+    : _header(other._header),
+      _control_block_region(std::move(other._control_block_region)),
+      _first_mapping(std::move(other._first_mapping)),
+      _second_mapping(std::move(other._second_mapping)),
+      _size(other._size),
+      _cursor(other._cursor),
+      _active(other._active),
+      _uncommitted_reads(other._uncommitted_reads),
+      _lapped(other._lapped),
+      _dropped_bytes(other._dropped_bytes)
+{
+  other._cursor = nullptr;
+}
+
+broadcast_reader::~broadcast_reader()
+{
+  if (!_cursor)
+  {
+    return;
+  }
+
+  uint32_t expected = broadcast_control_block::registering;
+  if (_cursor->state.compare_exchange_strong(
+          expected, broadcast_control_block::unused, std::memory_order_acq_rel))
+  {
+    // The writer never saw us, take back our registration request
+    _header.pending_registrations.fetch_sub(1, std::memory_order_relaxed);
+    return;
+  }
+  _cursor->state.store(broadcast_control_block::unused, std::memory_order_release);
+}
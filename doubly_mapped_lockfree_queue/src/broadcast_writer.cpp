@@ -0,0 +1,114 @@
+#include "broadcast_writer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+
+char* broadcast_writer::get_writer_ptr(size_t bytes_to_write)
+{
+  // Unlike queue_writer no slot is wasted: positions are monotonic, so a full
+  // ring and an empty ring never look the same.
+  if (bytes_to_write + _uncommitted_writes > _size)
+  {
+    return nullptr;
+  }
+
+  const uint64_t write_position = _header.next_write_position.load(std::memory_order_relaxed);
+  const uint64_t end_position = write_position + _uncommitted_writes + bytes_to_write;
+
+  if (_policy == overflow_policy::overwrite_oldest)
+  {
+    // Tell the readers which region is about to be overwritten *before*
+    // touching it. Pairs with the acquire fence in broadcast_reader::pop.
+    _header.write_reserve_position.store(end_position, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+  else if (end_position - _slowest_reader_position > _size)
+  {
+    _slowest_reader_position = slowest_reader_position(write_position);
+    if (end_position - _slowest_reader_position > _size)
+    {
+      return nullptr;
+    }
+  }
+
+  char* writer_ptr = _first_mapping.get_address() + (write_position % _size) + _uncommitted_writes;
+
+  _uncommitted_writes += bytes_to_write;
+  return writer_ptr;
+}
+
+broadcast_writer::mutable_view broadcast_writer::get_buffer(size_t bytes_to_write)
+{
+  if (_header.pending_registrations.load(std::memory_order_acquire))
+  {
+    accept_readers();
+  }
+
+  char* const writer_ptr = get_writer_ptr(bytes_to_write);
+  if (writer_ptr)
+  {
+    return {writer_ptr, bytes_to_write};
+  }
+  return {nullptr, 0};
+}
+
+void broadcast_writer::push(size_t bytes_to_commit)
+{
+  assert(_uncommitted_writes >= bytes_to_commit);
+  const uint64_t write_position = _header.next_write_position.load(std::memory_order_relaxed);
+
+  _header.next_write_position.store(write_position + bytes_to_commit, std::memory_order_release);
+  _uncommitted_writes -= bytes_to_commit;
+}
+
+void broadcast_writer::accept_readers()
+{
+  const uint64_t write_position = _header.next_write_position.load(std::memory_order_relaxed);
+  for (broadcast_control_block::reader_cursor& reader : _header.readers)
+  {
+    // The new reader starts from the next message we push. Any earlier
+    // message could already be partially overwritten. We CAS because the
+    // reader could be giving up its slot at the same time.
+    uint32_t expected = broadcast_control_block::registering;
+    if (reader.state.load(std::memory_order_relaxed) == expected)
+    {
+      reader.next_read_position.store(write_position, std::memory_order_relaxed);
+      if (reader.state.compare_exchange_strong(
+              expected, broadcast_control_block::active, std::memory_order_acq_rel))
+      {
+        _header.pending_registrations.fetch_sub(1, std::memory_order_relaxed);
+      }
+    }
+  }
+}
+
+uint64_t broadcast_writer::slowest_reader_position(uint64_t write_position) const
+{
+  uint64_t slowest = write_position;
+  for (const broadcast_control_block::reader_cursor& reader : _header.readers)
+  {
+    if (reader.state.load(std::memory_order_acquire) == broadcast_control_block::active)
+    {
+      slowest = std::min(slowest, reader.next_read_position.load(std::memory_order_acquire));
+    }
+  }
+  return slowest;
+}
+
+broadcast_writer::broadcast_writer(mapped_memory&& control_block_region,
+                                   mapped_memory&& first_mapping,
+                                   mapped_memory&& second_mapping,
+                                   size_t size,
+                                   overflow_policy policy)
+    : _header(control_block_region.get_header<broadcast_control_block>()),
+      _control_block_region(std::move(control_block_region)),
+      _first_mapping(std::move(first_mapping)),
+      _second_mapping(std::move(second_mapping)),
+      _size(size),
+      _policy(policy)
+{
+  _header.policy.store(_policy, std::memory_order_release);
+  _slowest_reader_position =
+      slowest_reader_position(_header.next_write_position.load(std::memory_order_relaxed));
+}
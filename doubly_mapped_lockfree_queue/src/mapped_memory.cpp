@@ -4,7 +4,9 @@
 #include <cstddef>
 #include <stdexcept>
 #include <string>
+#include <linux/magic.h>
 #include <sys/mman.h>
+#include <sys/vfs.h>
 #include <unistd.h>
 
 #include "file_descriptor.h"
@@ -13,15 +15,24 @@ mapped_memory::mapped_memory(const std::string& filename,
                              size_t expected_size,
                              void* start_addr,
                              size_t offset)
-    : _length(expected_size)
+    : mapped_memory(file_descriptor(filename, expected_size, O_CREAT | O_RDWR),
+                    expected_size,
+                    start_addr,
+                    offset)
 {
-  file_descriptor file(filename, expected_size, O_CREAT | O_RDWR);
+}
 
-  _mapped_region = map_memory(expected_size, start_addr, file.fd(), offset);
+mapped_memory::mapped_memory(const file_descriptor& file,
+                             size_t expected_size,
+                             void* start_addr,
+                             size_t offset)
+    : _mapped_region(map_memory(expected_size, start_addr, file.fd(), offset)),
+      _length(expected_size)
+{
 }
 
 mapped_memory::mapped_memory(size_t expected_size, void* start_addr, size_t offset)
-    : _mapped_region(map_memory(expected_size, start_addr, 0, offset)), _length(expected_size)
+    : _mapped_region(map_memory(expected_size, start_addr, -1, offset)), _length(expected_size)
 {
 }
 
@@ -29,6 +40,7 @@ mapped_memory& mapped_memory::operator=(mapped_memory&& other) noexcept
 {
   std::swap(_mapped_region, other._mapped_region);
   std::swap(_length, other._length);
+  std::swap(_sync_on_destruction, other._sync_on_destruction);
   return *this;
 }
 
@@ -42,11 +54,34 @@ mapped_memory::~mapped_memory()
 {
   if (_mapped_region)
   {
-    msync(true /*synchronous*/);
+    if (_sync_on_destruction)
+    {
+      msync(true /*synchronous*/);
+    }
     ::munmap(_mapped_region, _length);
   }
 }
 
+size_t mapped_memory::page_size_of(const std::string& filename)
+{
+  struct statfs fs_info = {};
+  if (::statfs(filename.c_str(), &fs_info) == 0 && fs_info.f_type == HUGETLBFS_MAGIC)
+  {
+    return fs_info.f_bsize;
+  }
+  return getpagesize();
+}
+
+size_t mapped_memory::page_size_of(const file_descriptor& file)
+{
+  struct statfs fs_info = {};
+  if (::fstatfs(file.fd(), &fs_info) == 0 && fs_info.f_type == HUGETLBFS_MAGIC)
+  {
+    return fs_info.f_bsize;
+  }
+  return getpagesize();
+}
+
 void* mapped_memory::map_memory(size_t expected_size, void* start_addr, int fd, size_t offset)
 {
   [[maybe_unused]] const size_t page_size = getpagesize();
@@ -66,7 +101,7 @@ void* mapped_memory::map_memory(size_t expected_size, void* start_addr, int fd,
     flags |= MAP_FIXED;
   }
 
-  if (fd)
+  if (fd != -1)
   {
     flags |= MAP_SHARED_VALIDATE;
   }
@@ -0,0 +1,96 @@
+#include "memfd_queue_files.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+namespace
+{
+constexpr size_t num_files = 2;
+}
+
+memfd_queue_files
+memfd_queue_files::create(size_t queue_size, size_t control_block_size, int memfd_flags)
+{
+  return {file_descriptor::memfd("queue", queue_size, memfd_flags),
+          file_descriptor::memfd("control_block", control_block_size)};
+}
+
+void memfd_queue_files::send(int unix_socket) const
+{
+  const int fds[num_files] = {queue.fd(), control_block.fd()};
+
+  // At least one byte of real data has to go along with the descriptors
+  char payload = 'Q';
+  iovec io{&payload, sizeof(payload)};
+
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+  msghdr message{};
+  message.msg_iov = &io;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  cmsghdr* const header = CMSG_FIRSTHDR(&message);
+  header->cmsg_level = SOL_SOCKET;
+  header->cmsg_type = SCM_RIGHTS;
+  header->cmsg_len = CMSG_LEN(sizeof(fds));
+  std::memcpy(CMSG_DATA(header), fds, sizeof(fds));
+
+  if (::sendmsg(unix_socket, &message, 0) != sizeof(payload))
+  {
+    throw std::runtime_error("cannot send the queue files. Error: " + std::to_string(errno));
+  }
+}
+
+memfd_queue_files memfd_queue_files::receive(int unix_socket)
+{
+  char payload{};
+  iovec io{&payload, sizeof(payload)};
+
+  alignas(cmsghdr) char control[CMSG_SPACE(num_files * sizeof(int))] = {};
+  msghdr message{};
+  message.msg_iov = &io;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  // The control buffer has only room for num_files descriptors
+  std::vector<file_descriptor> files;
+  files.reserve(num_files);
+
+  const ssize_t received = ::recvmsg(unix_socket, &message, MSG_CMSG_CLOEXEC);
+  const int recv_errno = errno;
+
+  // Own whatever descriptors came along right away, so that every check
+  // below that fails closes them
+  for (cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header))
+  {
+    if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS)
+    {
+      const size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      for (size_t i = 0; i < count && files.size() < num_files; ++i)
+      {
+        int fd = -1;
+        std::memcpy(&fd, CMSG_DATA(header) + i * sizeof(int), sizeof(fd));
+        files.emplace_back(fd);
+      }
+    }
+  }
+
+  if (received != sizeof(payload))
+  {
+    throw std::runtime_error("cannot receive the queue files. Error: " +
+                             std::to_string(recv_errno));
+  }
+
+  if (files.size() != num_files || (message.msg_flags & MSG_CTRUNC))
+  {
+    throw std::runtime_error("the peer did not send the queue files");
+  }
+
+  return {std::move(files[0]), std::move(files[1])};
+}
@@ -0,0 +1,106 @@
+#include "mpsc_writer.h"
+
+#include <atomic>
+#include <cassert>
+#include <x86intrin.h> // _mm_pause()
+
+char* mpsc_writer::get_writer_ptr(size_t bytes_to_write)
+{
+  assert(!_reserved_bytes && "push the previous reservation first");
+  // As with queue_writer one slot is wasted
+  assert(_size >= 1);
+  if (bytes_to_write > _size - 1)
+  {
+    return nullptr;
+  }
+
+  // A fetch_add would be cheaper, but it cannot be undone when the queue is
+  // full, and the reader would then wait on a reservation that never
+  // completes. We only move the reservation cursor when there is room.
+  uint64_t cur_reserve_offset = _header.next_reserve_offset.load(std::memory_order_relaxed);
+  while (true)
+  {
+    const uint64_t cur_next_read_offset = _header.next_read_offset.load(std::memory_order_acquire);
+    assert(cur_next_read_offset < _size);
+    assert(cur_reserve_offset < _size);
+
+    size_t writable_bytes{};
+    if (cur_next_read_offset <= cur_reserve_offset)
+    {
+      // |--r-w--|-------|
+      writable_bytes = (_size - 1 - cur_reserve_offset) + cur_next_read_offset;
+    }
+    else // if (cur_next_read_offset > cur_reserve_offset)
+    {
+      // |--w-r--|-------|
+      writable_bytes = cur_next_read_offset - cur_reserve_offset - 1;
+    }
+
+    if (bytes_to_write > writable_bytes)
+    {
+      return nullptr;
+    }
+
+    if (_header.next_reserve_offset.compare_exchange_weak(cur_reserve_offset,
+                                                          advance(cur_reserve_offset, bytes_to_write),
+                                                          std::memory_order_relaxed))
+    {
+      break;
+    }
+  }
+
+  _reserved_offset = cur_reserve_offset;
+  _reserved_bytes = bytes_to_write;
+  return _first_mapping.get_address() + cur_reserve_offset;
+}
+
+mpsc_writer::mutable_view mpsc_writer::get_buffer(size_t bytes_to_write)
+{
+  char* const writer_ptr = get_writer_ptr(bytes_to_write);
+  if (writer_ptr)
+  {
+    return {writer_ptr, bytes_to_write};
+  }
+  return {nullptr, 0};
+}
+
+void mpsc_writer::push(size_t bytes_to_commit)
+{
+  assert(_reserved_bytes == bytes_to_commit);
+
+  // Wait for the writers that reserved before us. Since at most size - 1
+  // bytes are reserved and not committed, next_write_offset can only be
+  // equal to our offset when it is our turn.
+  while (_header.next_write_offset.load(std::memory_order_acquire) != _reserved_offset)
+  {
+    _mm_pause();
+  }
+
+  _header.next_write_offset.store(advance(_reserved_offset, bytes_to_commit),
+                                  std::memory_order_release);
+  _reserved_bytes = 0;
+}
+
+uint64_t mpsc_writer::advance(uint64_t offset, size_t bytes) const
+{
+  uint64_t new_offset = offset + bytes;
+  if (new_offset >= _size)
+  {
+    // This is crossing over the boundary, then we need to scale it back of "size"
+    new_offset -= _size;
+  }
+  assert(new_offset < _size);
+  return new_offset;
+}
+
+mpsc_writer::mpsc_writer(mapped_memory&& control_block_region,
+                         mapped_memory&& first_mapping,
+                         mapped_memory&& second_mapping,
+                         size_t size)
+    : _header(control_block_region.get_header<control_block>()),
+      _control_block_region(std::move(control_block_region)),
+      _first_mapping(std::move(first_mapping)),
+      _second_mapping(std::move(second_mapping)),
+      _size(size)
+{
+}
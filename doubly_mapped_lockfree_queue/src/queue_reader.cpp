@@ -11,37 +11,43 @@
 
 #include "queue_reader.h"
 
-const char* queue_reader::get_reader_ptr(size_t bytes_to_read)
+size_t queue_reader::readable_bytes(uint64_t next_write_offset) const
 {
-  if (bytes_to_read + _uncommitted_reads > _size)
-  {
-    return nullptr;
-  }
-
-  const uint64_t cur_reader_offset = _header.next_read_offset.load(std::memory_order_relaxed);
-  const uint64_t cur_next_write_offset = _header.next_write_offset.load(std::memory_order_acquire);
-  assert(cur_reader_offset < _size);
-  assert(cur_next_write_offset < _size);
+  assert(_read_offset < _size);
+  assert(next_write_offset < _size);
 
   // Distinguish 2 cases
-  size_t readable_bytes{};
-  if (cur_reader_offset <= cur_next_write_offset)
+  if (_read_offset <= next_write_offset)
   {
     // |--r-w--|-------|
-    readable_bytes = cur_next_write_offset - cur_reader_offset;
+    return next_write_offset - _read_offset;
   }
-  else // if (cur_reader_offset > cur_next_write_offset)
+  else // if (_read_offset > next_write_offset)
   {
     // |--w-r--|-------|
-    readable_bytes = cur_next_write_offset + (_size - cur_reader_offset);
+    return next_write_offset + (_size - _read_offset);
   }
+}
 
-  if (bytes_to_read + _uncommitted_reads > readable_bytes)
+const char* queue_reader::get_reader_ptr(size_t bytes_to_read)
+{
+  if (bytes_to_read + _uncommitted_reads > _size)
   {
     return nullptr;
   }
 
-  const char* reader_ptr = _first_mapping.get_address() + cur_reader_offset + _uncommitted_reads;
+  // The writer can only have added bytes since we last looked, so we only
+  // pull its cache line over when our stale copy says there's not enough.
+  if (bytes_to_read + _uncommitted_reads > readable_bytes(_cached_next_write_offset))
+  {
+    _cached_next_write_offset = _header.next_write_offset.load(std::memory_order_acquire);
+    if (bytes_to_read + _uncommitted_reads > readable_bytes(_cached_next_write_offset))
+    {
+      return nullptr;
+    }
+  }
+
+  const char* reader_ptr = _first_mapping.get_address() + _read_offset + _uncommitted_reads;
 
   _uncommitted_reads += bytes_to_read;
   return reader_ptr;
@@ -60,13 +66,38 @@ queue_reader::const_view queue_reader::get_buffer(size_t bytes_to_read)
   }
 }
 
+queue_reader::const_view queue_reader::wait_buffer(size_t bytes_to_read)
+{
+  assert(_wait_strategy && "the reader was built without a wait_strategy");
+  // The writer never fills more than size - 1 bytes, so no matter how long we
+  // wait there won't be more than that to read
+  assert(bytes_to_read + _uncommitted_reads < _size);
+  const char* reader_ptr = get_reader_ptr(bytes_to_read);
+  if (!reader_ptr)
+  {
+    // Give back the space we committed and have not published yet, e.g.
+    // through a queue_batch, the writer may be waiting for it.
+    publish();
+    reader_ptr = detail::wait_until(
+        [this, bytes_to_read] { return get_reader_ptr(bytes_to_read); },
+        _header.reader_parked,
+        *_wait_strategy);
+  }
+  return {reader_ptr, bytes_to_read};
+}
+
 void queue_reader::pop(size_t bytes_to_commit)
+{
+  commit(bytes_to_commit);
+  publish();
+}
+
+void queue_reader::commit(size_t bytes_to_commit)
 {
   assert(bytes_to_commit < _size);
   assert(_uncommitted_reads >= bytes_to_commit);
-  const uint64_t cur_reader_offset = _header.next_read_offset.load(std::memory_order_relaxed);
 
-  uint64_t new_reader_offset = cur_reader_offset + bytes_to_commit;
+  uint64_t new_reader_offset = _read_offset + bytes_to_commit;
   if (new_reader_offset >= _size)
   {
     // This is crossing over the boundary, then we need to scale it back of "size"
@@ -74,18 +105,32 @@ void queue_reader::pop(size_t bytes_to_commit)
   }
   assert(new_reader_offset < _size);
 
-  _header.next_read_offset.store(new_reader_offset, std::memory_order_release);
+  _read_offset = new_reader_offset;
   _uncommitted_reads -= bytes_to_commit;
 }
 
+void queue_reader::publish()
+{
+  _header.next_read_offset.store(_read_offset, std::memory_order_release);
+
+  if (_wait_strategy)
+  {
+    detail::wake_if_parked(_header.writer_parked);
+  }
+}
+
 queue_reader::queue_reader(mapped_memory&& control_block_region,
                            mapped_memory&& first_mapping,
                            mapped_memory&& second_mapping,
-                           size_t size)
+                           size_t size,
+                           std::optional<wait_strategy> strategy)
     : _header(control_block_region.get_header<control_block>()),
       _control_block_region(std::move(control_block_region)),
       _first_mapping(std::move(first_mapping)),
       _second_mapping(std::move(second_mapping)),
-      _size(size)
+      _size(size),
+      _wait_strategy(strategy),
+      _read_offset(_header.next_read_offset.load(std::memory_order_relaxed)),
+      _cached_next_write_offset(_header.next_write_offset.load(std::memory_order_acquire))
 {
 }
@@ -1,39 +1,46 @@
 #include "queue_writer.h"
 
-char* queue_writer::get_writer_ptr(size_t bytes_to_write)
+size_t queue_writer::writable_bytes(uint64_t next_read_offset) const
 {
-  // The writer can only write size-1 at most, this is due to how the queue
-  // is designed.
-  assert(_size >= 1);
-  if (bytes_to_write + _uncommitted_writes > _size - 1)
-  {
-    return nullptr;
-  }
-
-  const uint64_t cur_write_offset = _header.next_write_offset.load(std::memory_order_relaxed);
-  const uint64_t cur_next_read_offset = _header.next_read_offset.load(std::memory_order_acquire);
-  assert(cur_next_read_offset < _size);
-  assert(cur_write_offset < _size);
+  assert(next_read_offset < _size);
+  assert(_write_offset < _size);
 
   // Distinguish 2 cases
-  size_t writable_bytes{};
-  if (cur_next_read_offset <= cur_write_offset)
+  if (next_read_offset <= _write_offset)
   {
     // |--r-w--|-------|
-    writable_bytes = (_size - 1 - cur_write_offset) + cur_next_read_offset;
+    return (_size - 1 - _write_offset) + next_read_offset;
   }
-  else // if (cur_next_read_offset > cur_write_offset)
+  else // if (next_read_offset > _write_offset)
   {
     // |--w-r--|-------|
-    writable_bytes = cur_next_read_offset - cur_write_offset - 1;
+    return next_read_offset - _write_offset - 1;
   }
+}
 
-  if (bytes_to_write + _uncommitted_writes > writable_bytes)
+char* queue_writer::get_writer_ptr(size_t bytes_to_write)
+{
+  // The writer can only write size-1 at most, this is due to how the queue
+  // is designed.
+  assert(_size >= 1);
+  if (bytes_to_write + _uncommitted_writes > _size - 1)
   {
     return nullptr;
   }
 
-  char* writer_ptr = _first_mapping.get_address() + cur_write_offset + _uncommitted_writes;
+  // The reader can only have freed more space since we last looked, so as long
+  // as our stale copy of its offset says there's room we don't need to pull
+  // its cache line over.
+  if (bytes_to_write + _uncommitted_writes > writable_bytes(_cached_next_read_offset))
+  {
+    _cached_next_read_offset = _header.next_read_offset.load(std::memory_order_acquire);
+    if (bytes_to_write + _uncommitted_writes > writable_bytes(_cached_next_read_offset))
+    {
+      return nullptr;
+    }
+  }
+
+  char* writer_ptr = _first_mapping.get_address() + _write_offset + _uncommitted_writes;
 
   _uncommitted_writes += bytes_to_write;
   return writer_ptr;
@@ -49,12 +56,37 @@ queue_writer::mutable_view queue_writer::get_buffer(size_t bytes_to_write)
   return {nullptr, 0};
 }
 
+queue_writer::mutable_view queue_writer::wait_buffer(size_t bytes_to_write)
+{
+  assert(_wait_strategy && "the writer was built without a wait_strategy");
+  // get_writer_ptr never gives out more than that, no matter how long we wait
+  assert(bytes_to_write + _uncommitted_writes <= _size - 1);
+  char* writer_ptr = get_writer_ptr(bytes_to_write);
+  if (!writer_ptr)
+  {
+    // The reader may be waiting on what we committed and have not published
+    // yet, e.g. through a queue_batch, and it won't free any space before it
+    // gets it.
+    publish();
+    writer_ptr = detail::wait_until(
+        [this, bytes_to_write] { return get_writer_ptr(bytes_to_write); },
+        _header.writer_parked,
+        *_wait_strategy);
+  }
+  return {writer_ptr, bytes_to_write};
+}
+
 void queue_writer::push(size_t bytes_to_commit)
+{
+  commit(bytes_to_commit);
+  publish();
+}
+
+void queue_writer::commit(size_t bytes_to_commit)
 {
   assert(_uncommitted_writes >= bytes_to_commit);
-  const uint64_t cur_write_offset = _header.next_write_offset.load(std::memory_order_relaxed);
 
-  uint64_t new_next_write_offset = cur_write_offset + bytes_to_commit;
+  uint64_t new_next_write_offset = _write_offset + bytes_to_commit;
   if (new_next_write_offset >= _size)
   {
     // This is crossing over the boundary, then we need to scale it back of "size"
@@ -62,18 +94,38 @@ void queue_writer::push(size_t bytes_to_commit)
   }
   assert(new_next_write_offset < _size);
 
-  _header.next_write_offset.store(new_next_write_offset, std::memory_order_release);
+  _write_offset = new_next_write_offset;
   _uncommitted_writes -= bytes_to_commit;
 }
 
+void queue_writer::publish()
+{
+  _header.next_write_offset.store(_write_offset, std::memory_order_release);
+
+  if (_wait_strategy)
+  {
+    detail::wake_if_parked(_header.reader_parked);
+  }
+}
+
+void queue_writer::set_sync_on_destruction(bool sync)
+{
+  _control_block_region.set_sync_on_destruction(sync);
+  _first_mapping.set_sync_on_destruction(sync);
+}
+
 queue_writer::queue_writer(mapped_memory&& control_block_region,
                            mapped_memory&& first_mapping,
                            mapped_memory&& second_mapping,
-                           size_t size)
+                           size_t size,
+                           std::optional<wait_strategy> strategy)
     : _header(control_block_region.get_header<control_block>()),
       _control_block_region(std::move(control_block_region)),
       _first_mapping(std::move(first_mapping)),
       _second_mapping(std::move(second_mapping)),
-      _size(size)
+      _size(size),
+      _wait_strategy(strategy),
+      _write_offset(_header.next_write_offset.load(std::memory_order_relaxed)),
+      _cached_next_read_offset(_header.next_read_offset.load(std::memory_order_acquire))
 {
 }
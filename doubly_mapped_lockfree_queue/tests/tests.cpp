@@ -9,15 +9,22 @@
 
 #include <fstream>
 #include <string>
+#include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <thread>
 #include <unistd.h>
 
 #include "Logger.h"
+#include "broadcast_reader.h"
+#include "broadcast_writer.h"
 #include "control_block.h"
 #include "file_descriptor.h"
 #include "mapped_memory.h"
+#include "memfd_queue_files.h"
+#include "mpsc_writer.h"
+#include "queue_batch.h"
 #include "queue_reader.h"
 #include "queue_writer.h"
 
@@ -132,6 +139,27 @@ TEST(mapped_memory, write_and_read_from_two_contiguous_regions)
   EXPECT_EQ('3', *second_mapping_begin);
 }
 
+TEST(mapped_memory, double_map_aligned_to_huge_pages)
+{
+  const std::string data_file = "data2.bin";
+  file_cleaner cleaner(data_file);
+
+  // A plain file can be mapped at any page boundary, so we can check the
+  // alignment logic even where hugetlbfs is not available.
+  constexpr size_t huge_page_size = 2 * 1024 * 1024;
+  file_descriptor data(data_file, huge_page_size);
+  EXPECT_EQ(getpagesize(), mapped_memory::page_size_of(data_file));
+
+  auto [first_mapping, second_mapping] =
+      detail::queue_base<queue_reader>::double_map(data, huge_page_size, huge_page_size);
+
+  EXPECT_EQ(0, reinterpret_cast<std::uintptr_t>(first_mapping.get_address()) % huge_page_size);
+  EXPECT_EQ(first_mapping.get_address() + huge_page_size, second_mapping.get_address());
+
+  *(first_mapping.get_address() + huge_page_size - 1) = '7';
+  EXPECT_EQ('7', *(second_mapping.get_address() + huge_page_size - 1));
+}
+
 std::string get_queue_content(size_t size)
 {
   assert(!(size % 8));
@@ -485,4 +513,746 @@ TEST(Queue, queue_write_and_read_random_messages)
     }
     exit(0);
   }
-}
\ No newline at end of file
+}
+
+TEST(Broadcast, every_reader_gets_every_message)
+{
+  const std::string queue_filepath = "queue9.bin";
+  file_cleaner cleaner(queue_filepath);
+
+  constexpr size_t queue_size = 4096;
+  file_descriptor queue_file(queue_filepath, queue_size);
+
+  const std::string control_block_file = "control_block9.bin";
+  file_cleaner cleaner_2(control_block_file);
+
+  const size_t num_insertions{100'000};
+  const size_t num_readers{3};
+
+  broadcast_writer writer = broadcast_writer::queue_factory(queue_filepath, control_block_file);
+
+  std::vector<std::jthread> readers;
+  std::atomic<size_t> ready_readers{};
+  for (size_t i = 0; i < num_readers; ++i)
+  {
+    readers.emplace_back(
+        [&]
+        {
+          broadcast_reader reader =
+              broadcast_reader::queue_factory(queue_filepath, control_block_file);
+          ready_readers++;
+
+          uint64_t expected{};
+          while (expected != num_insertions)
+          {
+            broadcast_reader::const_view reader_buf = reader.get_buffer(sizeof(uint64_t));
+            if (reader_buf)
+            {
+              uint64_t value{};
+              std::memcpy(&value, reader_buf.data(), sizeof(value));
+              EXPECT_EQ(expected, value);
+              EXPECT_TRUE(reader.pop(sizeof(value)));
+              expected++;
+            }
+          }
+          EXPECT_EQ(0, reader.dropped_bytes());
+        });
+  }
+
+  // Make sure every reader is registered before the first message, otherwise
+  // a late reader would (correctly) miss the first few.
+  while (ready_readers != num_readers)
+  {
+  }
+  while (!writer.get_buffer(0))
+  {
+  }
+
+  for (uint64_t i = 0; i < num_insertions;)
+  {
+    broadcast_writer::mutable_view write_buf = writer.get_buffer(sizeof(i));
+    if (write_buf)
+    {
+      std::memcpy(write_buf.data(), &i, sizeof(i));
+      writer.push(sizeof(i));
+      i++;
+    }
+  }
+}
+
+TEST(Broadcast, writer_waits_for_slowest_reader)
+{
+  const std::string queue_filepath = "queue10.bin";
+  file_cleaner cleaner(queue_filepath);
+
+  constexpr size_t queue_size = 4096;
+  file_descriptor queue_file(queue_filepath, queue_size);
+
+  const std::string control_block_file = "control_block10.bin";
+  file_cleaner cleaner_2(control_block_file);
+
+  broadcast_writer writer = broadcast_writer::queue_factory(queue_filepath, control_block_file);
+  broadcast_reader fast_reader =
+      broadcast_reader::queue_factory(queue_filepath, control_block_file);
+  broadcast_reader slow_reader =
+      broadcast_reader::queue_factory(queue_filepath, control_block_file);
+
+  // Unlike the SPSC queue the whole ring can be used.
+  ASSERT_TRUE(writer.get_buffer(queue_size));
+  writer.push(queue_size);
+  ASSERT_FALSE(writer.get_buffer(1));
+
+  ASSERT_TRUE(fast_reader.get_buffer(queue_size));
+  EXPECT_TRUE(fast_reader.pop(queue_size));
+
+  // The slow reader still holds the whole ring
+  ASSERT_FALSE(writer.get_buffer(1));
+
+  ASSERT_TRUE(slow_reader.get_buffer(8));
+  EXPECT_TRUE(slow_reader.pop(8));
+  ASSERT_TRUE(writer.get_buffer(8));
+  ASSERT_FALSE(writer.get_buffer(1));
+}
+
+TEST(Broadcast, overwrite_oldest_drops_for_lapped_readers)
+{
+  const std::string queue_filepath = "queue11.bin";
+  file_cleaner cleaner(queue_filepath);
+
+  constexpr size_t queue_size = 4096;
+  file_descriptor queue_file(queue_filepath, queue_size);
+
+  const std::string control_block_file = "control_block11.bin";
+  file_cleaner cleaner_2(control_block_file);
+
+  broadcast_writer writer = broadcast_writer::queue_factory(
+      queue_filepath, control_block_file, overflow_policy::overwrite_oldest);
+  broadcast_reader reader = broadcast_reader::queue_factory(queue_filepath, control_block_file);
+
+  const std::string message("0123456789");
+  const auto write_message = [&]
+  {
+    broadcast_writer::mutable_view write_buf = writer.get_buffer(message.size());
+    ASSERT_TRUE(write_buf);
+    memcpy(write_buf.data(), message.data(), message.size());
+    writer.push(message.size());
+  };
+
+  // The writer never blocks, it laps the reader more than once
+  const size_t num_messages = 3 * queue_size / message.size();
+  for (size_t i = 0; i < num_messages; ++i)
+  {
+    write_message();
+  }
+
+  // Nothing to read: the reader skips to the latest message
+  EXPECT_FALSE(reader.get_buffer(message.size()));
+  EXPECT_EQ(num_messages * message.size(), reader.dropped_bytes());
+
+  write_message();
+  {
+    broadcast_reader::const_view reader_buf = reader.get_buffer(message.size());
+    ASSERT_TRUE(reader_buf);
+    EXPECT_EQ(message, std::string(reader_buf.data(), message.size()));
+    EXPECT_TRUE(reader.pop(message.size()));
+  }
+
+  // Now get overwritten while holding a view
+  write_message();
+  ASSERT_TRUE(reader.get_buffer(message.size()));
+  for (size_t i = 0; i < queue_size / message.size(); ++i)
+  {
+    write_message();
+  }
+  EXPECT_FALSE(reader.pop(message.size()));
+
+  // Or while waiting for the rest of a message: the reader reports it rather
+  // than failing forever
+  write_message();
+  ASSERT_TRUE(reader.get_buffer(message.size()));
+  for (size_t i = 0; i < queue_size / message.size() + 1; ++i)
+  {
+    write_message();
+  }
+  EXPECT_FALSE(reader.lapped());
+  EXPECT_FALSE(reader.get_buffer(message.size()));
+  EXPECT_TRUE(reader.lapped());
+  EXPECT_FALSE(reader.get_buffer(message.size()));
+  EXPECT_FALSE(reader.pop(message.size()));
+  EXPECT_FALSE(reader.lapped());
+
+  write_message();
+  {
+    broadcast_reader::const_view reader_buf = reader.get_buffer(message.size());
+    ASSERT_TRUE(reader_buf);
+    EXPECT_EQ(message, std::string(reader_buf.data(), message.size()));
+    EXPECT_TRUE(reader.pop(message.size()));
+  }
+}
+
+TEST(Broadcast, too_many_readers)
+{
+  const std::string queue_filepath = "queue12.bin";
+  file_cleaner cleaner(queue_filepath);
+
+  constexpr size_t queue_size = 4096;
+  file_descriptor queue_file(queue_filepath, queue_size);
+
+  const std::string control_block_file = "control_block12.bin";
+  file_cleaner cleaner_2(control_block_file);
+
+  std::vector<std::unique_ptr<broadcast_reader>> readers;
+  for (size_t i = 0; i < broadcast_control_block::max_readers; ++i)
+  {
+    readers.push_back(std::make_unique<broadcast_reader>(
+        broadcast_reader::queue_factory(queue_filepath, control_block_file)));
+  }
+  EXPECT_THROW(broadcast_reader::queue_factory(queue_filepath, control_block_file),
+               std::runtime_error);
+
+  // Releasing one makes room for another
+  readers.pop_back();
+  EXPECT_NO_THROW(broadcast_reader::queue_factory(queue_filepath, control_block_file));
+}
+
+TEST(Mpsc, writers_from_many_processes)
+{
+  const std::string queue_filepath = "queue13.bin";
+  file_cleaner cleaner(queue_filepath);
+
+  constexpr size_t queue_size = 4096;
+  file_descriptor queue_file(queue_filepath, queue_size);
+
+  const std::string control_block_file = "control_block13.bin";
+  file_cleaner cleaner_2(control_block_file);
+
+  const uint64_t num_writers{3};
+  const uint64_t num_insertions{10'000};
+
+  struct message
+  {
+    uint64_t writer_id;
+    uint64_t sequence;
+  };
+
+  // Create the queue before forking so that no child writes in a queue the
+  // reader has not seen yet.
+  queue_reader reader = queue_reader::queue_factory(queue_filepath, control_block_file);
+
+  std::vector<int> pids;
+  for (uint64_t writer_id = 0; writer_id < num_writers; ++writer_id)
+  {
+    const int pid = fork();
+    if (pid == 0)
+    {
+      // Child
+      mpsc_writer writer = mpsc_writer::queue_factory(queue_filepath, control_block_file);
+      for (uint64_t sequence = 0; sequence < num_insertions;)
+      {
+        mpsc_writer::mutable_view write_buf = writer.get_buffer(sizeof(message));
+        if (write_buf)
+        {
+          const message m{writer_id, sequence};
+          std::memcpy(write_buf.data(), &m, sizeof(m));
+          writer.push(sizeof(m));
+          sequence++;
+        }
+      }
+      exit(0);
+    }
+    pids.push_back(pid);
+  }
+
+  // Parent: every writer's messages must come in order and uncorrupted
+  std::vector<uint64_t> next_sequence(num_writers, 0);
+  for (uint64_t reads = 0; reads < num_writers * num_insertions;)
+  {
+    queue_reader::const_view reader_buf = reader.get_buffer(sizeof(message));
+    if (reader_buf)
+    {
+      message m{};
+      std::memcpy(&m, reader_buf.data(), sizeof(m));
+      ASSERT_LT(m.writer_id, num_writers);
+      ASSERT_EQ(next_sequence[m.writer_id], m.sequence);
+      next_sequence[m.writer_id]++;
+      reader.pop(sizeof(m));
+      reads++;
+    }
+  }
+
+  for (const int pid : pids)
+  {
+    int child_ret_value{};
+    waitpid(pid, &child_ret_value, 0);
+    EXPECT_EQ(0, child_ret_value);
+  }
+}
+
+TEST(WaitStrategy, reader_sleeps_until_writer_pushes)
+{
+  const std::string queue_filepath = "queue14.bin";
+  file_cleaner cleaner(queue_filepath);
+
+  constexpr size_t queue_size = 4096;
+  file_descriptor queue_file(queue_filepath, queue_size);
+
+  const std::string control_block_file = "control_block14.bin";
+  file_cleaner cleaner_2(control_block_file);
+
+  // Go to sleep straight away, and for long enough that only a wake up from
+  // the writer can make the test pass in time.
+  const wait_strategy strategy{0, 0, 1, std::chrono::seconds(30)};
+
+  queue_reader reader =
+      queue_reader::queue_factory(queue_filepath, control_block_file, strategy);
+  queue_writer writer =
+      queue_writer::queue_factory(queue_filepath, control_block_file, strategy);
+
+  const std::string message("123456789");
+  const auto start = std::chrono::steady_clock::now();
+
+  std::jthread t(
+      [&]
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        queue_writer::mutable_view write_buf = writer.get_buffer(message.size());
+        ASSERT_TRUE(write_buf);
+        memcpy(write_buf.data(), message.data(), message.size());
+        writer.push(message.size());
+      });
+
+  queue_reader::const_view reader_buf = reader.wait_buffer(message.size());
+  ASSERT_TRUE(reader_buf);
+  EXPECT_EQ(message, std::string(reader_buf.data(), message.size()));
+  reader.pop(message.size());
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(10));
+}
+
+TEST(WaitStrategy, writer_sleeps_until_reader_pops)
+{
+  const std::string queue_filepath = "queue15.bin";
+  file_cleaner cleaner(queue_filepath);
+
+  constexpr size_t queue_size = 4096;
+  file_descriptor queue_file(queue_filepath, queue_size);
+
+  const std::string control_block_file = "control_block15.bin";
+  file_cleaner cleaner_2(control_block_file);
+
+  const wait_strategy strategy{0, 0, 1, std::chrono::seconds(30)};
+
+  queue_reader reader =
+      queue_reader::queue_factory(queue_filepath, control_block_file, strategy);
+  queue_writer writer =
+      queue_writer::queue_factory(queue_filepath, control_block_file, strategy);
+
+  ASSERT_TRUE(writer.get_buffer(queue_size - 1));
+  writer.push(queue_size - 1);
+
+  const auto start = std::chrono::steady_clock::now();
+  std::jthread t(
+      [&]
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        ASSERT_TRUE(reader.get_buffer(8));
+        reader.pop(8);
+      });
+
+  EXPECT_TRUE(writer.wait_buffer(8));
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(10));
+}
+
+TEST(WaitStrategy, queue_write_and_read_with_sleeps)
+{
+  const std::string queue_filepath = "queue16.bin";
+  file_cleaner cleaner(queue_filepath);
+
+  constexpr size_t queue_size = 4096;
+  file_descriptor queue_file(queue_filepath, queue_size);
+
+  const std::string control_block_file = "control_block16.bin";
+  file_cleaner cleaner_2(control_block_file);
+
+  const size_t num_insertions{100'000};
+  const wait_strategy strategy{10, 10, 4, std::chrono::seconds(30)};
+
+  queue_reader reader =
+      queue_reader::queue_factory(queue_filepath, control_block_file, strategy);
+
+  std::jthread t(
+      [&]
+      {
+        queue_writer writer =
+            queue_writer::queue_factory(queue_filepath, control_block_file, strategy);
+        for (uint64_t i = 0; i < num_insertions; ++i)
+        {
+          queue_writer::mutable_view write_buf = writer.wait_buffer(sizeof(i));
+          std::memcpy(write_buf.data(), &i, sizeof(i));
+          writer.push(sizeof(i));
+        }
+      });
+
+  for (uint64_t expected = 0; expected < num_insertions; ++expected)
+  {
+    queue_reader::const_view reader_buf = reader.wait_buffer(sizeof(uint64_t));
+    uint64_t value{};
+    std::memcpy(&value, reader_buf.data(), sizeof(value));
+    ASSERT_EQ(expected, value);
+    reader.pop(sizeof(value));
+  }
+}
+
+TEST(WaitStrategy, batches_are_published_before_waiting)
+{
+  const std::string queue_filepath = "queue21.bin";
+  file_cleaner cleaner(queue_filepath);
+
+  constexpr size_t queue_size = 4096;
+  file_descriptor queue_file(queue_filepath, queue_size);
+
+  const std::string control_block_file = "control_block21.bin";
+  file_cleaner cleaner_2(control_block_file);
+
+  // Several times what the ring holds, and the batches on both sides never
+  // fill up, so each side only sees what the other publishes before waiting.
+  const size_t num_insertions{10'000};
+  const wait_strategy strategy{10, 10, 4, std::chrono::seconds(30)};
+
+  queue_reader reader =
+      queue_reader::queue_factory(queue_filepath, control_block_file, strategy);
+
+  std::jthread t(
+      [&]
+      {
+        queue_writer writer =
+            queue_writer::queue_factory(queue_filepath, control_block_file, strategy);
+        queue_batch batch(writer, num_insertions + 1);
+        for (uint64_t i = 0; i < num_insertions; ++i)
+        {
+          queue_writer::mutable_view write_buf = writer.wait_buffer(sizeof(i));
+          std::memcpy(write_buf.data(), &i, sizeof(i));
+          batch.commit(sizeof(i));
+        }
+      });
+
+  queue_batch batch(reader, num_insertions + 1);
+  for (uint64_t expected = 0; expected < num_insertions; ++expected)
+  {
+    queue_reader::const_view reader_buf = reader.wait_buffer(sizeof(uint64_t));
+    uint64_t value{};
+    std::memcpy(&value, reader_buf.data(), sizeof(value));
+    ASSERT_EQ(expected, value);
+    batch.commit(sizeof(value));
+  }
+}
+
+TEST(Queue, queue_on_hugetlbfs)
+{
+  const std::string hugetlbfs_dir = "/dev/hugepages";
+  if (!std::filesystem::exists(hugetlbfs_dir) ||
+      mapped_memory::page_size_of(hugetlbfs_dir) == static_cast<size_t>(getpagesize()))
+  {
+    GTEST_SKIP() << "hugetlbfs is not mounted on " << hugetlbfs_dir;
+  }
+
+  const std::string queue_filepath = hugetlbfs_dir + "/queue17.bin";
+  file_cleaner cleaner(queue_filepath);
+
+  const size_t queue_size = mapped_memory::page_size_of(hugetlbfs_dir);
+  try
+  {
+    file_descriptor queue_file(queue_filepath, queue_size);
+  }
+  catch (const std::runtime_error& e)
+  {
+    GTEST_SKIP() << "No huge pages available: " << e.what();
+  }
+
+  const std::string control_block_file = "control_block17.bin";
+  file_cleaner cleaner_2(control_block_file);
+
+  queue_writer writer = queue_writer::queue_factory(queue_filepath, control_block_file);
+  queue_reader reader = queue_reader::queue_factory(queue_filepath, control_block_file);
+
+  // Wrap a message around the end of the ring
+  const std::string message("this_is_a_long_message");
+  ASSERT_TRUE(writer.get_buffer(queue_size - message.size() / 2));
+  writer.push(queue_size - message.size() / 2);
+  ASSERT_TRUE(reader.get_buffer(queue_size - message.size() / 2));
+  reader.pop(queue_size - message.size() / 2);
+
+  queue_writer::mutable_view write_buf = writer.get_buffer(message.size());
+  ASSERT_TRUE(write_buf);
+  memcpy(write_buf.data(), message.data(), message.size());
+  writer.push(message.size());
+
+  queue_reader::const_view reader_buf = reader.get_buffer(message.size());
+  ASSERT_TRUE(reader_buf);
+  EXPECT_EQ(message, std::string(reader_buf.data(), message.size()));
+}
+
+TEST(Queue, memfd_queue_sent_to_another_process)
+{
+  constexpr size_t queue_size = 4096;
+  const size_t num_insertions{100'000};
+
+  int sockets[2] = {};
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sockets));
+
+  const int pid = fork();
+
+  if (pid != 0)
+  {
+    // Parent
+    close(sockets[1]);
+    queue_reader reader = queue_reader::queue_factory(memfd_queue_files::receive(sockets[0]));
+    close(sockets[0]);
+
+    for (uint64_t expected = 0; expected < num_insertions;)
+    {
+      queue_reader::const_view reader_buf = reader.get_buffer(sizeof(uint64_t));
+      if (reader_buf)
+      {
+        uint64_t value{};
+        std::memcpy(&value, reader_buf.data(), sizeof(value));
+        ASSERT_EQ(expected, value);
+        reader.pop(sizeof(value));
+        expected++;
+      }
+    }
+
+    int child_ret_value{};
+    waitpid(pid, &child_ret_value, 0);
+    EXPECT_EQ(0, child_ret_value);
+  }
+  else
+  {
+    // Child
+    close(sockets[0]);
+    queue_writer writer = [&]
+    {
+      const memfd_queue_files files = memfd_queue_files::create(queue_size);
+      files.send(sockets[1]);
+      return queue_writer::queue_factory(files);
+    }(); // The descriptors are closed here, the mappings keep the queue alive
+    close(sockets[1]);
+
+    for (uint64_t i = 0; i < num_insertions;)
+    {
+      queue_writer::mutable_view write_buf = writer.get_buffer(sizeof(i));
+      if (write_buf)
+      {
+        std::memcpy(write_buf.data(), &i, sizeof(i));
+        writer.push(sizeof(i));
+        i++;
+      }
+    }
+    exit(0);
+  }
+}
+
+TEST(Queue, memfd_receive_from_closed_socket)
+{
+  int sockets[2] = {};
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sockets));
+  close(sockets[1]);
+  EXPECT_THROW(memfd_queue_files::receive(sockets[0]), std::runtime_error);
+  close(sockets[0]);
+}
+
+TEST(Queue, memfd_receive_closes_unexpected_files)
+{
+  int sockets[2] = {};
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sockets));
+  int pipe_fds[2] = {};
+  ASSERT_EQ(0, pipe2(pipe_fds, O_NONBLOCK));
+
+  // Send only one descriptor, the write end of a pipe
+  char payload = 'Q';
+  iovec io{&payload, sizeof(payload)};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+  msghdr message{};
+  message.msg_iov = &io;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  cmsghdr* const header = CMSG_FIRSTHDR(&message);
+  header->cmsg_level = SOL_SOCKET;
+  header->cmsg_type = SCM_RIGHTS;
+  header->cmsg_len = CMSG_LEN(sizeof(int));
+  std::memcpy(CMSG_DATA(header), &pipe_fds[1], sizeof(int));
+  ASSERT_EQ(static_cast<ssize_t>(sizeof(payload)), sendmsg(sockets[1], &message, 0));
+  close(pipe_fds[1]);
+
+  EXPECT_THROW(memfd_queue_files::receive(sockets[0]), std::runtime_error);
+
+  // The received copy was the last write end left, so the pipe is closed
+  char byte{};
+  EXPECT_EQ(0, read(pipe_fds[0], &byte, sizeof(byte)));
+
+  close(pipe_fds[0]);
+  close(sockets[0]);
+  close(sockets[1]);
+}
+
+TEST(Batch, writer_publishes_once_per_batch)
+{
+  const std::string queue_filepath = "queue18.bin";
+  file_cleaner cleaner(queue_filepath);
+
+  constexpr size_t queue_size = 4096;
+  file_descriptor queue_file(queue_filepath, queue_size);
+
+  const std::string control_block_file = "control_block18.bin";
+  file_cleaner cleaner_2(control_block_file);
+
+  queue_writer writer = queue_writer::queue_factory(queue_filepath, control_block_file);
+  queue_reader reader = queue_reader::queue_factory(queue_filepath, control_block_file);
+
+  const size_t batch_size = 10;
+  {
+    queue_batch batch(writer, batch_size);
+    for (uint64_t i = 0; i < batch_size - 1; ++i)
+    {
+      ASSERT_TRUE(writer.get_buffer(sizeof(i)));
+      batch.commit(sizeof(i));
+      EXPECT_FALSE(reader.get_buffer(sizeof(i)));
+    }
+
+    ASSERT_TRUE(writer.get_buffer(sizeof(uint64_t)));
+    batch.commit(sizeof(uint64_t));
+    EXPECT_TRUE(reader.get_buffer(batch_size * sizeof(uint64_t)));
+    reader.pop(batch_size * sizeof(uint64_t));
+
+    // A partial batch is published on destruction
+    ASSERT_TRUE(writer.get_buffer(sizeof(uint64_t)));
+    batch.commit(sizeof(uint64_t));
+    EXPECT_FALSE(reader.get_buffer(sizeof(uint64_t)));
+  }
+  EXPECT_TRUE(reader.get_buffer(sizeof(uint64_t)));
+}
+
+TEST(Batch, reader_gives_space_back_once_per_batch)
+{
+  const std::string queue_filepath = "queue19.bin";
+  file_cleaner cleaner(queue_filepath);
+
+  constexpr size_t queue_size = 4096;
+  file_descriptor queue_file(queue_filepath, queue_size);
+
+  const std::string control_block_file = "control_block19.bin";
+  file_cleaner cleaner_2(control_block_file);
+
+  queue_writer writer = queue_writer::queue_factory(queue_filepath, control_block_file);
+  queue_reader reader = queue_reader::queue_factory(queue_filepath, control_block_file);
+
+  ASSERT_TRUE(writer.get_buffer(queue_size - 1));
+  writer.push(queue_size - 1);
+
+  queue_batch batch(reader, 2);
+  ASSERT_TRUE(reader.get_buffer(8));
+  batch.commit(8);
+  EXPECT_FALSE(writer.get_buffer(8));
+
+  ASSERT_TRUE(reader.get_buffer(8));
+  batch.commit(8);
+  EXPECT_TRUE(writer.get_buffer(16));
+}
+
+TEST(Batch, poll_publishes_once_the_delay_has_passed)
+{
+  const std::string queue_filepath = "queue22.bin";
+  file_cleaner cleaner(queue_filepath);
+
+  constexpr size_t queue_size = 4096;
+  file_descriptor queue_file(queue_filepath, queue_size);
+
+  const std::string control_block_file = "control_block22.bin";
+  file_cleaner cleaner_2(control_block_file);
+
+  queue_writer writer = queue_writer::queue_factory(queue_filepath, control_block_file);
+  queue_reader reader = queue_reader::queue_factory(queue_filepath, control_block_file);
+
+  const auto max_delay = std::chrono::milliseconds(20);
+  queue_batch batch(writer, 32, max_delay);
+  const auto start = std::chrono::steady_clock::now();
+  ASSERT_TRUE(writer.get_buffer(sizeof(uint64_t)));
+  batch.commit(sizeof(uint64_t));
+
+  // Nothing more is committed, so only poll() can tell the delay has passed
+  batch.poll();
+  if (std::chrono::steady_clock::now() - start < max_delay)
+  {
+    EXPECT_FALSE(reader.get_buffer(sizeof(uint64_t)));
+  }
+
+  std::this_thread::sleep_for(max_delay);
+  EXPECT_FALSE(reader.get_buffer(sizeof(uint64_t)));
+  batch.poll();
+  EXPECT_TRUE(reader.get_buffer(sizeof(uint64_t)));
+}
+
+TEST(Batch, queue_write_and_read_in_batches)
+{
+  const std::string queue_filepath = "queue20.bin";
+  file_cleaner cleaner(queue_filepath);
+
+  constexpr size_t queue_size = 4096;
+  file_descriptor queue_file(queue_filepath, queue_size);
+
+  const std::string control_block_file = "control_block20.bin";
+  file_cleaner cleaner_2(control_block_file);
+
+  const size_t num_insertions{100'000};
+  const size_t batch_size{32};
+
+  queue_reader reader = queue_reader::queue_factory(queue_filepath, control_block_file);
+
+  const int pid = fork();
+
+  if (pid != 0)
+  {
+    // Parent
+    queue_batch batch(reader, batch_size);
+    for (uint64_t expected = 0; expected < num_insertions;)
+    {
+      queue_reader::const_view reader_buf = reader.get_buffer(sizeof(uint64_t));
+      if (reader_buf)
+      {
+        uint64_t value{};
+        std::memcpy(&value, reader_buf.data(), sizeof(value));
+        ASSERT_EQ(expected, value);
+        batch.commit(sizeof(value));
+        expected++;
+      }
+    }
+
+    int child_ret_value{};
+    waitpid(pid, &child_ret_value, 0);
+    EXPECT_EQ(0, child_ret_value);
+  }
+  else
+  {
+    // Child
+    {
+      queue_writer writer = queue_writer::queue_factory(queue_filepath, control_block_file);
+      queue_batch batch(writer, batch_size, std::chrono::microseconds(10));
+      for (uint64_t i = 0; i < num_insertions;)
+      {
+        queue_writer::mutable_view write_buf = writer.get_buffer(sizeof(i));
+        if (write_buf)
+        {
+          std::memcpy(write_buf.data(), &i, sizeof(i));
+          batch.commit(sizeof(i));
+          i++;
+        }
+        else
+        {
+          // Don't hold back what we have while waiting for space
+          batch.publish();
+        }
+      }
+    }
+    exit(0);
+  }
+}
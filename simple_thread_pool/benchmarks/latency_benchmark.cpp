@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <latch>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "simple_thread_pool.hpp"
+
+namespace
+{
+using benchmark_clock = std::chrono::steady_clock;
+
+void print_percentiles(const std::string& name_, std::vector<double>& latencies_ns_)
+{
+  std::sort(latencies_ns_.begin(), latencies_ns_.end());
+  const auto percentile = [&latencies_ns_](double p)
+  { return latencies_ns_[static_cast<size_t>(p * (latencies_ns_.size() - 1))] / 1000.; };
+
+  std::cout << std::setw(28) << std::left << name_ << std::fixed << std::setprecision(1)
+            << " p50 " << std::setw(8) << std::right << percentile(.5) << "us"
+            << " p99 " << std::setw(8) << percentile(.99) << "us"
+            << " max " << std::setw(8) << percentile(1.) << "us" << std::endl;
+}
+
+/**
+ * Submits "tasks_" tasks one at a time, each after the previous one finished
+ * and the pool had "idle_" to go idle, and returns how long each one took to
+ * start.
+ */
+std::vector<double> measure_low_load(simple_thread_pool& pool_,
+                                     int tasks_,
+                                     std::chrono::microseconds idle_)
+{
+  std::vector<double> latencies_ns(tasks_);
+  for (int i = 0; i < tasks_; ++i)
+  {
+    std::this_thread::sleep_for(idle_);
+
+    const auto submitted = benchmark_clock::now();
+    pool_
+        .add_task2(
+            [submitted, &latency = latencies_ns[i]]
+            {
+              const std::chrono::duration<double, std::nano> elapsed =
+                  benchmark_clock::now() - submitted;
+              latency = elapsed.count();
+            })
+        .get();
+  }
+  return latencies_ns;
+}
+
+/**
+ * Submits "tasks_" short tasks back to back and returns how long each one
+ * took to start.
+ */
+std::vector<double> measure_high_load(simple_thread_pool& pool_, int tasks_)
+{
+  std::vector<double> latencies_ns(tasks_);
+  std::latch done(tasks_);
+  for (int i = 0; i < tasks_; ++i)
+  {
+    const auto submitted = benchmark_clock::now();
+    pool_.add_task2(
+        [submitted, &latency = latencies_ns[i], &done]
+        {
+          const std::chrono::duration<double, std::nano> elapsed =
+              benchmark_clock::now() - submitted;
+          latency = elapsed.count();
+
+          // Some busy work so that the workers cannot keep up
+          const auto until = benchmark_clock::now() + std::chrono::microseconds(2);
+          while (benchmark_clock::now() < until)
+          {
+          }
+          done.count_down();
+        });
+  }
+  done.wait();
+  return latencies_ns;
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  const size_t threads = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4;
+  const int tasks = argc > 2 ? std::atoi(argv[2]) : 2000;
+
+  std::cout << "Submit to start latency, " << threads << " threads" << std::endl;
+  for (const size_t spin_iterations : {size_t{0}, simple_thread_pool::default_spin_iterations})
+  {
+    const std::string spin = "spin " + std::to_string(spin_iterations);
+    simple_thread_pool pool(threads, scheduling::shared_queue, spin_iterations);
+
+    std::vector<double> back_to_back = measure_low_load(pool, tasks, std::chrono::microseconds(0));
+    print_percentiles(spin + ", back to back", back_to_back);
+
+    std::vector<double> idle = measure_low_load(pool, tasks / 10, std::chrono::milliseconds(1));
+    print_percentiles(spin + ", after 1ms idle", idle);
+
+    std::vector<double> loaded = measure_high_load(pool, tasks * 10);
+    print_percentiles(spin + ", high load", loaded);
+  }
+
+  return 0;
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <utility>
+
+/**
+ * Recycles small heap blocks, so that the short lived allocations made for
+ * every task (e.g. the shared state of a std::promise) stop hitting the heap
+ * once the pool is warm.
+ *
+ * Every thread keeps a short free list per size class and only goes to the
+ * central, locked, list to move blocks in batches. Blocks often die on a
+ * different thread than the one that allocated them (a worker vs whoever
+ * waits on the future), and the central list is what lets them flow back.
+ *
+ * Blocks of up to 256 bytes are never given back to the heap.
+ */
+class block_pool
+{
+  public:
+  static constexpr size_t min_block_size = 64;
+  static constexpr size_t size_classes = 3; // 64, 128 and 256 bytes
+  static constexpr size_t batch_size = 32;
+
+  static void* allocate(size_t bytes_)
+  {
+    const size_t c = size_class(bytes_);
+    if (c == size_classes)
+    {
+      return ::operator new(bytes_);
+    }
+
+    free_list refill;
+    free_list& local = _cache_destroyed ? refill : _cache.lists[c];
+    if (!local.head)
+    {
+      central(c).move_to(local, batch_size);
+    }
+    if (!local.head)
+    {
+      // Out of blocks everywhere we can look, carve a new batch of them out of
+      // a single allocation.
+      const size_t block_size = min_block_size << c;
+      std::byte* const slab = static_cast<std::byte*>(::operator new(batch_size * block_size));
+      for (size_t i = 0; i < batch_size; ++i)
+      {
+        local.push(slab + i * block_size);
+      }
+    }
+
+    void* const block = local.pop();
+    if (&local == &refill)
+    {
+      central(c).take_all(refill);
+    }
+    return block;
+  }
+
+  static void deallocate(void* p_, size_t bytes_) noexcept
+  {
+    const size_t c = size_class(bytes_);
+    if (c == size_classes)
+    {
+      ::operator delete(p_);
+      return;
+    }
+
+    if (_cache_destroyed)
+    {
+      free_list single;
+      single.push(p_);
+      central(c).take_all(single);
+      return;
+    }
+
+    free_list& local = _cache.lists[c];
+    local.push(p_);
+    if (local.size == 2 * batch_size)
+    {
+      free_list spill;
+      local.move_to(spill, batch_size);
+      central(c).take_all(spill);
+    }
+  }
+
+  private:
+  struct free_block
+  {
+    free_block* next;
+  };
+
+  struct free_list
+  {
+    void push(void* p_)
+    {
+      head = new (p_) free_block{head};
+      ++size;
+    }
+
+    void* pop()
+    {
+      --size;
+      return std::exchange(head, head->next);
+    }
+
+    void move_to(free_list& other_, size_t max_blocks_)
+    {
+      for (size_t i = 0; i < max_blocks_ && head; ++i)
+      {
+        other_.push(pop());
+      }
+    }
+
+    free_block* head{};
+    size_t size{};
+  };
+
+  struct central_list
+  {
+    void move_to(free_list& local_, size_t max_blocks_)
+    {
+      std::lock_guard l(m);
+      blocks.move_to(local_, max_blocks_);
+    }
+
+    void take_all(free_list& local_)
+    {
+      std::lock_guard l(m);
+      local_.move_to(blocks, local_.size);
+    }
+
+    std::mutex m;
+    free_list blocks;
+  };
+
+  struct cache
+  {
+    ~cache()
+    {
+      for (size_t c = 0; c < size_classes; ++c)
+      {
+        central(c).take_all(lists[c]);
+      }
+      _cache_destroyed = true;
+    }
+
+    std::array<free_list, size_classes> lists;
+  };
+
+  static size_t size_class(size_t bytes_)
+  {
+    size_t c = 0;
+    while (c < size_classes && (min_block_size << c) < bytes_)
+    {
+      ++c;
+    }
+    return c;
+  }
+
+  static central_list& central(size_t class_)
+  {
+    // Never destroyed, blocks can be freed during static destruction.
+    static auto* lists = new std::array<central_list, size_classes>;
+    return (*lists)[class_];
+  }
+
+  static thread_local cache _cache;
+  // Blocks freed while the thread is shutting down bypass the cache.
+  static thread_local bool _cache_destroyed;
+};
+
+inline thread_local block_pool::cache block_pool::_cache;
+inline thread_local bool block_pool::_cache_destroyed{};
+
+/**
+ * A std allocator on top of block_pool.
+ */
+template <typename T>
+struct block_pool_allocator
+{
+  using value_type = T;
+
+  block_pool_allocator() = default;
+
+  template <typename U>
+  block_pool_allocator(const block_pool_allocator<U>&)
+  {
+  }
+
+  T* allocate(size_t n_)
+  {
+    static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+    return static_cast<T*>(block_pool::allocate(n_ * sizeof(T)));
+  }
+
+  void deallocate(T* p_, size_t n_) noexcept { block_pool::deallocate(p_, n_ * sizeof(T)); }
+
+  template <typename U>
+  bool operator==(const block_pool_allocator<U>&) const
+  {
+    return true;
+  }
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+/**
+ * A growable work-stealing deque, as described in "Correct and Efficient
+ * Work-Stealing for Weak Memory Models" (Le, Pop, Cohen, Zappa Nardelli).
+ *
+ * The owner thread pushes and takes at the bottom (LIFO, so it works on what
+ * is hot in its cache) while any other thread can steal from the top (FIFO).
+ * Only trivially copyable items are supported, in practice pointers.
+ */
+template <typename T>
+class chase_lev_deque
+{
+  static_assert(std::is_trivially_copyable_v<T>);
+
+  public:
+  explicit chase_lev_deque(size_t initial_capacity_ = 64)
+  {
+    assert(initial_capacity_ && (initial_capacity_ & (initial_capacity_ - 1)) == 0);
+    _rings.emplace_back(std::make_unique<ring>(initial_capacity_));
+    _ring.store(_rings.back().get(), std::memory_order_relaxed);
+  }
+
+  chase_lev_deque(const chase_lev_deque&) = delete;
+  chase_lev_deque& operator=(const chase_lev_deque&) = delete;
+
+  /**
+   * Owner only.
+   */
+  void push(T item_)
+  {
+    const int64_t b = _bottom.load(std::memory_order_relaxed);
+    const int64_t t = _top.load(std::memory_order_acquire);
+    ring* r = _ring.load(std::memory_order_relaxed);
+
+    if (b - t > static_cast<int64_t>(r->capacity) - 1)
+    {
+      r = grow(r, b, t);
+    }
+
+    r->put(b, item_);
+    std::atomic_thread_fence(std::memory_order_release);
+    _bottom.store(b + 1, std::memory_order_relaxed);
+  }
+
+  /**
+   * Owner only. Returns the most recently pushed item.
+   */
+  std::optional<T> take()
+  {
+    const int64_t b = _bottom.load(std::memory_order_relaxed) - 1;
+    ring* const r = _ring.load(std::memory_order_relaxed);
+    _bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = _top.load(std::memory_order_relaxed);
+
+    std::optional<T> item;
+    if (t <= b)
+    {
+      item = r->get(b);
+      if (t == b)
+      {
+        // Last item, race the thieves for it.
+        if (!_top.compare_exchange_strong(
+                t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+          item.reset();
+        }
+        _bottom.store(b + 1, std::memory_order_relaxed);
+      }
+    }
+    else
+    {
+      _bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    return item;
+  }
+
+  /**
+   * Any thread. Returns the oldest item, or nothing if the deque is empty or
+   * another thread got there first.
+   */
+  std::optional<T> steal()
+  {
+    int64_t t = _top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64_t b = _bottom.load(std::memory_order_acquire);
+
+    if (t < b)
+    {
+      // The paper uses a consume load here.
+      ring* const r = _ring.load(std::memory_order_acquire);
+      const T item = r->get(t);
+      if (_top.compare_exchange_strong(
+              t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+      {
+        return item;
+      }
+    }
+
+    return std::nullopt;
+  }
+
+  /**
+   * A racy estimate, only meant for heuristics.
+   */
+  bool empty() const
+  {
+    return _bottom.load(std::memory_order_relaxed) <=
+           _top.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * A racy estimate, only meant for heuristics and stats.
+   */
+  size_t size() const
+  {
+    const int64_t b = _bottom.load(std::memory_order_relaxed);
+    const int64_t t = _top.load(std::memory_order_relaxed);
+    return b > t ? static_cast<size_t>(b - t) : 0;
+  }
+
+  private:
+  struct ring
+  {
+    explicit ring(size_t capacity_)
+        : capacity(capacity_),
+          mask(capacity_ - 1),
+          items(std::make_unique<std::atomic<T>[]>(capacity_))
+    {
+    }
+
+    T get(int64_t i_) const
+    {
+      return items[static_cast<size_t>(i_) & mask].load(std::memory_order_relaxed);
+    }
+
+    void put(int64_t i_, T item_)
+    {
+      items[static_cast<size_t>(i_) & mask].store(item_, std::memory_order_relaxed);
+    }
+
+    const size_t capacity;
+    const size_t mask;
+    std::unique_ptr<std::atomic<T>[]> items;
+  };
+
+  ring* grow(ring* old_, int64_t bottom_, int64_t top_)
+  {
+    auto bigger = std::make_unique<ring>(old_->capacity * 2);
+    for (int64_t i = top_; i != bottom_; ++i)
+    {
+      bigger->put(i, old_->get(i));
+    }
+
+    // Thieves might still be reading from the old ring, so it is only freed
+    // together with the deque.
+    _rings.emplace_back(std::move(bigger));
+    ring* const r = _rings.back().get();
+    _ring.store(r, std::memory_order_release);
+    return r;
+  }
+
+  alignas(64) std::atomic<int64_t> _top{};
+  alignas(64) std::atomic<int64_t> _bottom{};
+  std::atomic<ring*> _ring{};
+
+  // Owner only
+  std::vector<std::unique_ptr<ring>> _rings;
+};
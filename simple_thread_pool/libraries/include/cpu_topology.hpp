@@ -0,0 +1,85 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/**
+ * The CPUs the calling thread is allowed to run on, or nothing if that is
+ * not known on this platform.
+ */
+inline std::vector<unsigned> available_cpus()
+{
+  std::vector<unsigned> cpus;
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0)
+  {
+    for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+      if (CPU_ISSET(cpu, &set))
+      {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+#endif
+  return cpus;
+}
+
+/**
+ * The NUMA node of cpu_, as the kernel reports it in sysfs. 0 when that is
+ * not known, which is right for single node machines.
+ */
+inline unsigned numa_node_of(unsigned cpu_)
+{
+  namespace fs = std::filesystem;
+
+  std::error_code ec;
+  const fs::path cpu_dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu_);
+  for (const fs::directory_entry& entry : fs::directory_iterator(cpu_dir, ec))
+  {
+    // The node is given by a link named node<N>
+    const std::string name = entry.path().filename().string();
+    const std::string_view digits = std::string_view(name).substr(std::min<size_t>(name.size(), 4));
+    if (name.starts_with("node") && !digits.empty() &&
+        digits.find_first_not_of("0123456789") == std::string_view::npos)
+    {
+      return static_cast<unsigned>(std::stoul(std::string(digits)));
+    }
+  }
+  return 0;
+}
+
+/**
+ * Restricts thread_ to run on cpu_ only.
+ * @return 0 or the error code of the failure
+ */
+inline int pin_to_cpu(std::thread& thread_, unsigned cpu_)
+{
+#if defined(__linux__)
+  if (cpu_ >= CPU_SETSIZE)
+  {
+    return EINVAL;
+  }
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu_, &set);
+  return pthread_setaffinity_np(thread_.native_handle(), sizeof(set), &set);
+#else
+  (void)thread_;
+  (void)cpu_;
+  return ENOTSUP;
+#endif
+}
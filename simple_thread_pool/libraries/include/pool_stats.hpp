@@ -0,0 +1,205 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Durations bucketed by powers of two of nanoseconds: bucket i counts the
+ * ones in [2^(i-1), 2^i) ns, bucket 0 counts zeros and the last bucket
+ * everything that is too long for the others.
+ */
+struct latency_histogram
+{
+  static constexpr size_t buckets = 40; // The last one starts at ~4.6 minutes
+
+  static size_t bucket(std::chrono::nanoseconds duration_)
+  {
+    const uint64_t ns = duration_.count() > 0 ? static_cast<uint64_t>(duration_.count()) : 0;
+    return std::min<size_t>(std::bit_width(ns), buckets - 1);
+  }
+
+  uint64_t count() const
+  {
+    uint64_t total{};
+    for (const uint64_t c : counts)
+    {
+      total += c;
+    }
+    return total;
+  }
+
+  /**
+   * An upper bound for the quantile q_ (e.g. 0.99), within a factor of 2.
+   * 0 when there is nothing in the histogram.
+   */
+  std::chrono::nanoseconds quantile(double q_) const
+  {
+    const uint64_t total = count();
+    if (total == 0)
+    {
+      return {};
+    }
+
+    const uint64_t rank = std::clamp<uint64_t>(
+        static_cast<uint64_t>(std::ceil(q_ * static_cast<double>(total))), 1, total);
+    uint64_t seen{};
+    size_t i = 0;
+    for (; i < buckets - 1; ++i)
+    {
+      seen += counts[i];
+      if (seen >= rank)
+      {
+        break;
+      }
+    }
+    return std::chrono::nanoseconds(int64_t{1} << i);
+  }
+
+  latency_histogram& operator+=(const latency_histogram& other_)
+  {
+    for (size_t i = 0; i < buckets; ++i)
+    {
+      counts[i] += other_.counts[i];
+    }
+    return *this;
+  }
+
+  std::array<uint64_t, buckets> counts{};
+};
+
+/**
+ * What one worker did since the pool started.
+ */
+struct worker_stats
+{
+  uint64_t tasks_run{};
+
+  // Where the tasks it ran came from
+  uint64_t shared_tasks{};
+  uint64_t local_tasks{};
+  uint64_t stolen_tasks{};
+
+  // Time spent running tasks and looking for them (spinning or parked)
+  std::chrono::nanoseconds busy_time{};
+  std::chrono::nanoseconds idle_time{};
+
+  // From submission to the task starting, and then to it returning
+  latency_histogram wait_time;
+  latency_histogram run_time;
+
+  worker_stats& operator+=(const worker_stats& other_)
+  {
+    tasks_run += other_.tasks_run;
+    shared_tasks += other_.shared_tasks;
+    local_tasks += other_.local_tasks;
+    stolen_tasks += other_.stolen_tasks;
+    busy_time += other_.busy_time;
+    idle_time += other_.idle_time;
+    wait_time += other_.wait_time;
+    run_time += other_.run_time;
+    return *this;
+  }
+};
+
+/**
+ * See simple_thread_pool::snapshot().
+ */
+struct pool_stats
+{
+  // Queue depths at the time of the snapshot
+  size_t queued_shared{};
+  size_t queued_local{};
+
+  std::vector<worker_stats> workers;
+
+  worker_stats total() const
+  {
+    worker_stats sum;
+    for (const worker_stats& w : workers)
+    {
+      sum += w;
+    }
+    return sum;
+  }
+};
+
+/**
+ * The live stats of one worker. Only the worker itself updates them, so an
+ * update is a relaxed load and store rather than a locked instruction, and
+ * they can be read at any time from any thread.
+ */
+class alignas(64) worker_counters
+{
+  public:
+  enum class source
+  {
+    shared,
+    local,
+    stolen
+  };
+
+  void task_taken(source source_)
+  {
+    switch (source_)
+    {
+    case source::shared:
+      bump(_shared_tasks);
+      break;
+    case source::local:
+      bump(_local_tasks);
+      break;
+    case source::stolen:
+      bump(_stolen_tasks);
+      break;
+    }
+  }
+
+  void task_ran(std::chrono::nanoseconds idle_before_,
+                std::chrono::nanoseconds wait_,
+                std::chrono::nanoseconds run_)
+  {
+    bump(_tasks_run);
+    bump(_idle_ns, static_cast<uint64_t>(std::max(idle_before_.count(), int64_t{})));
+    bump(_busy_ns, static_cast<uint64_t>(std::max(run_.count(), int64_t{})));
+    bump(_wait_time[latency_histogram::bucket(wait_)]);
+    bump(_run_time[latency_histogram::bucket(run_)]);
+  }
+
+  worker_stats read() const
+  {
+    worker_stats s;
+    s.tasks_run = _tasks_run.load(std::memory_order_relaxed);
+    s.shared_tasks = _shared_tasks.load(std::memory_order_relaxed);
+    s.local_tasks = _local_tasks.load(std::memory_order_relaxed);
+    s.stolen_tasks = _stolen_tasks.load(std::memory_order_relaxed);
+    s.busy_time = std::chrono::nanoseconds(_busy_ns.load(std::memory_order_relaxed));
+    s.idle_time = std::chrono::nanoseconds(_idle_ns.load(std::memory_order_relaxed));
+    for (size_t i = 0; i < latency_histogram::buckets; ++i)
+    {
+      s.wait_time.counts[i] = _wait_time[i].load(std::memory_order_relaxed);
+      s.run_time.counts[i] = _run_time[i].load(std::memory_order_relaxed);
+    }
+    return s;
+  }
+
+  private:
+  static void bump(std::atomic<uint64_t>& counter_, uint64_t n_ = 1)
+  {
+    counter_.store(counter_.load(std::memory_order_relaxed) + n_, std::memory_order_relaxed);
+  }
+
+  std::atomic<uint64_t> _tasks_run{};
+  std::atomic<uint64_t> _shared_tasks{};
+  std::atomic<uint64_t> _local_tasks{};
+  std::atomic<uint64_t> _stolen_tasks{};
+  std::atomic<uint64_t> _busy_ns{};
+  std::atomic<uint64_t> _idle_ns{};
+  std::array<std::atomic<uint64_t>, latency_histogram::buckets> _wait_time{};
+  std::array<std::atomic<uint64_t>, latency_histogram::buckets> _run_time{};
+};
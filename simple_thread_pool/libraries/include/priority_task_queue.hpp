@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "ring_queue.hpp"
+#include "small_task.hpp"
+
+enum class task_priority
+{
+  high,
+  normal,
+  background
+};
+
+/**
+ * The shared queue of simple_thread_pool: one FIFO lane per priority, plus
+ * tasks with a deadline, which go before all the lanes, earliest deadline
+ * first.
+ *
+ * A higher lane always goes first, except that a lane that has been passed
+ * over starvation_limit times in a row while it had something queued gets
+ * the next turn, so background work keeps trickling through a stream of
+ * high priority tasks. Not thread safe.
+ *
+ * Task is anything small_task-like: default constructible and movable.
+ */
+template <typename Task = small_task>
+class priority_task_queue
+{
+  public:
+  using clock = std::chrono::steady_clock;
+
+  static constexpr size_t starvation_limit = 16;
+
+  bool empty() const { return size() == 0; }
+
+  size_t size() const
+  {
+    size_t s = _deadline_tasks.size();
+    for (const auto& lane : _lanes)
+    {
+      s += lane.size();
+    }
+    return s;
+  }
+
+  /**
+   * How many tasks should go before whatever a worker has queued locally.
+   */
+  size_t urgent() const
+  {
+    return _deadline_tasks.size() + _lanes[lane(task_priority::high)].size();
+  }
+
+  void push(Task&& task_, task_priority priority_)
+  {
+    _lanes[lane(priority_)].push_back(std::move(task_));
+  }
+
+  void push(Task&& task_, clock::time_point deadline_)
+  {
+    _deadline_tasks.push_back({deadline_, _next_sequence++, std::move(task_)});
+    std::push_heap(_deadline_tasks.begin(), _deadline_tasks.end(), later);
+  }
+
+  Task pop()
+  {
+    assert(!empty());
+
+    if (!_deadline_tasks.empty())
+    {
+      std::pop_heap(_deadline_tasks.begin(), _deadline_tasks.end(), later);
+      Task t = std::move(_deadline_tasks.back().task);
+      _deadline_tasks.pop_back();
+      return t;
+    }
+
+    // The highest lane with something in it, unless a lower one has waited
+    // long enough.
+    size_t chosen = lanes;
+    for (size_t l = 0; l < lanes; ++l)
+    {
+      if (!_lanes[l].empty())
+      {
+        if (chosen == lanes || _skipped[l] >= starvation_limit)
+        {
+          chosen = l;
+        }
+      }
+    }
+
+    for (size_t l = chosen + 1; l < lanes; ++l)
+    {
+      if (!_lanes[l].empty())
+      {
+        ++_skipped[l];
+      }
+    }
+    _skipped[chosen] = 0;
+
+    return _lanes[chosen].pop_front();
+  }
+
+  private:
+  static constexpr size_t lanes = 3;
+
+  struct deadline_task
+  {
+    clock::time_point deadline;
+    // Keeps tasks with the same deadline in FIFO order
+    uint64_t sequence;
+    Task task;
+  };
+
+  static size_t lane(task_priority priority_) { return static_cast<size_t>(priority_); }
+
+  static bool later(const deadline_task& a_, const deadline_task& b_)
+  {
+    return a_.deadline != b_.deadline ? a_.deadline > b_.deadline : a_.sequence > b_.sequence;
+  }
+
+  std::vector<deadline_task> _deadline_tasks;
+  std::array<ring_queue<Task>, lanes> _lanes;
+  std::array<size_t, lanes> _skipped{};
+  uint64_t _next_sequence{};
+};
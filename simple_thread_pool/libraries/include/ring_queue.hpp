@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/**
+ * A FIFO queue on a ring that doubles when full and never shrinks, so that
+ * once it has grown to the usual backlog it stops allocating. Not thread
+ * safe.
+ */
+template <typename T>
+class ring_queue
+{
+  public:
+  explicit ring_queue(size_t initial_capacity_ = 64) : _items(initial_capacity_)
+  {
+    assert(initial_capacity_ && (initial_capacity_ & (initial_capacity_ - 1)) == 0);
+  }
+
+  bool empty() const { return _size == 0; }
+
+  size_t size() const { return _size; }
+
+  void push_back(T&& item_)
+  {
+    if (_size == _items.size())
+    {
+      grow();
+    }
+
+    _items[(_head + _size) & (_items.size() - 1)] = std::move(item_);
+    ++_size;
+  }
+
+  T pop_front()
+  {
+    assert(!empty());
+    T item = std::move(_items[_head]);
+    _head = (_head + 1) & (_items.size() - 1);
+    --_size;
+    return item;
+  }
+
+  private:
+  void grow()
+  {
+    std::vector<T> bigger(_items.size() * 2);
+    for (size_t i = 0; i < _size; ++i)
+    {
+      bigger[i] = std::move(_items[(_head + i) & (_items.size() - 1)]);
+    }
+    _items = std::move(bigger);
+    _head = 0;
+  }
+
+  std::vector<T> _items;
+  size_t _head{};
+  size_t _size{};
+};
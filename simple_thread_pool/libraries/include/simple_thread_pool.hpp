@@ -1,28 +1,110 @@
+#pragma once
+
 #include <atomic>
 #include <cassert>
 #include <chrono>
+#include <condition_variable>
+#include <coroutine>
 #include <exception>
+#include <functional>
 #include <future>
 #include <iostream>
 #include <list>
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <ranges>
+#include <span>
+#include <string>
+#include <system_error>
 #include <thread>
+#include <algorithm>
 #include <concepts>
+#include <vector>
+
+#include "block_pool.hpp"
+#include "chase_lev_deque.hpp"
+#include "cpu_topology.hpp"
+#include "pool_stats.hpp"
+#include "priority_task_queue.hpp"
+#include "small_task.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Define as 1 to have the workers keep the stats returned by
+// simple_thread_pool::snapshot(). When 0, none of that code is compiled in.
+#ifndef SIMPLE_THREAD_POOL_STATS
+#define SIMPLE_THREAD_POOL_STATS 0
+#endif
+
+/**
+ * How the workers share the tasks:
+ * - shared_queue: every task goes through one queue guarded by a mutex.
+ * - work_stealing: every worker also owns a deque. Tasks submitted from a
+ *   worker go to its own deque and idle workers steal from the others, so
+ *   fine grained tasks spawned by tasks do not contend on the shared queue.
+ */
+enum class scheduling
+{
+  shared_queue,
+  work_stealing
+};
 
 class simple_thread_pool
 {
   public:
   using Task = std::packaged_task<void(void)>;
+  using clock = std::chrono::steady_clock;
+
+  static constexpr size_t default_spin_iterations = 2000;
+  static constexpr bool stats_enabled = SIMPLE_THREAD_POOL_STATS;
+
+  /**
+   * An idle worker polls for work up to spin_iterations_ times before going
+   * to sleep on a condition variable. Each worker adapts how long it actually
+   * spins: it spins longer when spinning found work and less when it did not.
+   * 0 means go to sleep straight away.
+   */
   explicit simple_thread_pool(
-      size_t num_threads_ = std::thread::hardware_concurrency())
-      : _running(true)
+      size_t num_threads_ = std::thread::hardware_concurrency(),
+      scheduling scheduling_ = scheduling::shared_queue,
+      size_t spin_iterations_ = default_spin_iterations)
+      : _running(true), _scheduling(scheduling_), _spin_iterations(spin_iterations_)
   {
     assert(num_threads_);
-    for (size_t i = 0; i < num_threads_; ++i)
+    start(std::vector<unsigned>(num_threads_), {});
+  }
+
+  /**
+   * Runs one worker per entry of cpus_, each pinned to that cpu, e.g. to all
+   * of available_cpus(). Workers are grouped by NUMA node and, with work
+   * stealing, an idle worker steals from its own node before going to the
+   * others, so the tasks spawned by a task stay close to the caches and the
+   * memory it was using.
+   * @throw std::system_error if a worker cannot be pinned
+   */
+  explicit simple_thread_pool(std::vector<unsigned> cpus_,
+                              scheduling scheduling_ = scheduling::shared_queue,
+                              size_t spin_iterations_ = default_spin_iterations)
+      : _running(true), _scheduling(scheduling_), _spin_iterations(spin_iterations_)
+  {
+    assert(!cpus_.empty());
+    std::vector<std::pair<unsigned, unsigned>> placement; // node, cpu
+    for (const unsigned cpu : cpus_)
     {
-      _threads.emplace_back(std::thread([this] { this->thread_loop(); }));
+      placement.emplace_back(numa_node_of(cpu), cpu);
     }
+    std::ranges::stable_sort(placement, {}, &std::pair<unsigned, unsigned>::first);
+
+    std::vector<unsigned> nodes;
+    for (size_t i = 0; i < placement.size(); ++i)
+    {
+      nodes.push_back(placement[i].first);
+      cpus_[i] = placement[i].second;
+    }
+    start(nodes, cpus_);
   }
 
   simple_thread_pool(simple_thread_pool&&) = delete;
@@ -40,16 +122,265 @@ class simple_thread_pool
     {
       std::cout << "Exception on destruction: " << e_.what() << std::endl;
     }
+
+    // Whatever was never run, and the recycled nodes
+    for (auto& local_tasks : _local_tasks)
+    {
+      while (std::optional<task_node*> t = local_tasks->tasks.take())
+      {
+        delete *t;
+      }
+      delete_nodes(local_tasks->free_nodes);
+      delete_nodes(local_tasks->returned_nodes.load(std::memory_order_acquire));
+    }
   }
 
+  /**
+   * Runs callable_ on the pool. Small callables are submitted without
+   * touching the heap once the pool is warm: the callable is stored inline in
+   * the task and the promise's shared state comes from block_pool.
+   *
+   * Queued tasks run by priority_, then in the order they were submitted.
+   * With work stealing, only normal priority tasks submitted from a worker go
+   * to its own deque; the others go through the shared queue, and high
+   * priority ones are picked up before whatever the workers queued locally.
+   */
+  template <std::regular_invocable Callable,
+            typename return_type = typename std::result_of<Callable()>::type>
+  std::future<return_type> add_task2(Callable&& callable_,
+                                     task_priority priority_ = task_priority::normal)
+  {
+    auto [task, f] = package(std::forward<Callable>(callable_));
+    enqueue(std::move(task), priority_);
+    return std::move(f);
+  }
+
+  /**
+   * Runs callable_ before any task that was given a priority instead, and
+   * before the ones whose deadline is later. Nothing happens to a task that
+   * misses its deadline, it only decides the order.
+   */
   template <std::regular_invocable Callable,
             typename return_type = typename std::result_of<Callable()>::type>
-  std::future<return_type> add_task2(Callable&& callable_)
+  std::future<return_type> add_task2(Callable&& callable_, clock::time_point deadline_)
   {
-    std::promise<return_type> p;
+    auto [task, f] = package(std::forward<Callable>(callable_));
+    enqueue(std::move(task), deadline_);
+    return std::move(f);
+  }
+
+  void add_task(Task&& task_, task_priority priority_ = task_priority::normal)
+  {
+    assert(task_.valid());
+    enqueue(small_task(std::move(task_)), priority_);
+  }
+
+  /**
+   * Submits every callable in tasks_ at once, taking the queue's lock only
+   * once. The returned future is ready when all of them have run, and holds
+   * the first exception any of them threw.
+   */
+  template <std::ranges::sized_range Range>
+    requires std::invocable<std::ranges::range_value_t<Range>&>
+  std::future<void> add_tasks(Range&& tasks_, task_priority priority_ = task_priority::normal)
+  {
+    auto state = std::make_shared<bulk_state<void>>(std::ranges::size(tasks_));
+    return submit_bulk(std::move(state), std::forward<Range>(tasks_), priority_);
+  }
+
+  /**
+   * Calls fn_(i) for every i in [begin_, end_), in chunks of grain_ indices
+   * submitted together. A grain_ of 0 picks one that gives every worker a
+   * few chunks.
+   */
+  template <std::integral Index, typename Fn>
+    requires std::invocable<Fn&, Index>
+  std::future<void> parallel_for(Index begin_, Index end_, size_t grain_, Fn&& fn_)
+  {
+    const size_t size = end_ > begin_ ? static_cast<size_t>(end_ - begin_) : 0;
+    const size_t grain = grain_ ? grain_ : auto_grain(size);
+    const size_t chunks = (size + grain - 1) / grain;
+
+    auto fn = std::make_shared<std::decay_t<Fn>>(std::forward<Fn>(fn_));
+    return add_tasks(std::views::iota(size_t{0}, chunks) |
+                     std::views::transform(
+                         [fn, begin_, size, grain](size_t chunk_)
+                         {
+                           const auto [first, last] = chunk_bounds(begin_, size, grain, chunk_);
+                           return [fn, first, last]
+                           {
+                             for (Index i = first; i != last; ++i)
+                             {
+                               (*fn)(i);
+                             }
+                           };
+                         }),
+                     task_priority::normal);
+  }
+
+  /**
+   * Reduces map_(i) for every i in [begin_, end_) with reduce_, starting
+   * from identity_. Each chunk is reduced on its own and the partial results
+   * are then combined in order, so reduce_ needs to be associative but not
+   * commutative. A grain_ of 0 is picked as for parallel_for.
+   */
+  template <std::integral Index, typename T, typename Map, typename Reduce>
+    requires std::invocable<Map&, Index> && std::invocable<Reduce&, T, T>
+  std::future<T> parallel_reduce(
+      Index begin_, Index end_, size_t grain_, T identity_, Map&& map_, Reduce&& reduce_)
+  {
+    const size_t size = end_ > begin_ ? static_cast<size_t>(end_ - begin_) : 0;
+    const size_t grain = grain_ ? grain_ : auto_grain(size);
+    const size_t chunks = (size + grain - 1) / grain;
+
+    struct reduction
+    {
+      std::decay_t<Map> map;
+      std::decay_t<Reduce> reduce;
+      T identity;
+      std::vector<T> partials;
+    };
+    auto r = std::make_shared<reduction>(reduction{std::forward<Map>(map_),
+                                                   std::forward<Reduce>(reduce_),
+                                                   identity_,
+                                                   std::vector<T>(chunks, identity_)});
+
+    auto state = std::make_shared<bulk_state<T>>(chunks);
+    state->finish = [r]
+    {
+      T result = r->identity;
+      for (T& partial : r->partials)
+      {
+        result = r->reduce(std::move(result), std::move(partial));
+      }
+      return result;
+    };
+
+    return submit_bulk(std::move(state),
+                       std::views::iota(size_t{0}, chunks) |
+                           std::views::transform(
+                               [r, begin_, size, grain](size_t chunk_)
+                               {
+                                 const auto [first, last] =
+                                     chunk_bounds(begin_, size, grain, chunk_);
+                                 return [r, first, last, chunk_]
+                                 {
+                                   T partial = r->identity;
+                                   for (Index i = first; i != last; ++i)
+                                   {
+                                     partial = r->reduce(std::move(partial), r->map(i));
+                                   }
+                                   r->partials[chunk_] = std::move(partial);
+                                 };
+                               }),
+                       task_priority::normal);
+  }
+
+  /**
+   * co_await pool.schedule() suspends the calling coroutine and resumes it
+   * on one of the workers, see task.hpp. Nothing is allocated to get there.
+   */
+  auto schedule(task_priority priority_ = task_priority::normal)
+  {
+    struct awaiter
+    {
+      bool await_ready() const noexcept { return false; }
+
+      void await_suspend(std::coroutine_handle<> coroutine_)
+      {
+        pool.enqueue(small_task([coroutine_] { coroutine_.resume(); }), priority);
+      }
+
+      void await_resume() const noexcept {}
+
+      simple_thread_pool& pool;
+      task_priority priority;
+    };
+
+    return awaiter{*this, priority_};
+  }
+
+  /**
+   * What the pool is up to, read while the workers carry on. The queue
+   * depths are always there, the per worker stats only when built with
+   * SIMPLE_THREAD_POOL_STATS. Each counter is read atomically, but the
+   * snapshot is not taken at a single point in time.
+   */
+  pool_stats snapshot() const
+  {
+    pool_stats s;
+    s.queued_shared = _shared_tasks.load(std::memory_order_relaxed);
+    for (const auto& local : _local_tasks)
+    {
+      s.queued_local += local->tasks.size();
+    }
+    for (const auto& counters : _worker_counters)
+    {
+      s.workers.push_back(counters->read());
+    }
+    return s;
+  }
+
+  /**
+   * Blocks until all the threads complete what they are doing and stop
+   * @throw std::runtime_error if any of the tasks threw an error
+   */
+  void sync_stop()
+  {
+    if (!_running)
+    {
+      return;
+    }
+
+    enqueue(small_task([this] { stop_when_idle(); }), task_priority::background);
+
+    for (auto& t : _threads)
+    {
+      if (t.joinable())
+      {
+        t.join();
+      }
+    }
+  }
+
+  private:
+  /**
+   * A task that remembers when it was submitted, for the stats.
+   */
+  struct timed_task
+  {
+    explicit operator bool() const { return static_cast<bool>(task); }
+
+    void operator()() { task(); }
+
+    small_task task;
+    clock::time_point submitted;
+  };
+
+  // What the queues hold
+  using queued_task = std::conditional_t<stats_enabled, timed_task, small_task>;
+
+  template <typename Queued = queued_task>
+  static Queued make_queued(small_task&& task_)
+  {
+    if constexpr (stats_enabled)
+    {
+      return Queued{std::move(task_), clock::now()};
+    }
+    else
+    {
+      return std::move(task_);
+    }
+  }
+
+  template <typename Callable,
+            typename return_type = typename std::result_of<Callable()>::type>
+  static std::pair<small_task, std::future<return_type>> package(Callable&& callable_)
+  {
+    std::promise<return_type> p(std::allocator_arg, block_pool_allocator<return_type>());
     std::future<return_type> f = p.get_future();
 
-    std::packaged_task<void(void)> task(
+    small_task task(
         [p = std::move(p), c = std::move(callable_)]() mutable {
           try
           {
@@ -69,89 +400,569 @@ class simple_thread_pool
           }
         });
 
-    std::lock_guard<std::mutex> l(_m);
-    unsafe_add_task(std::move(task));
+    return {std::move(task), std::move(f)};
+  }
+
+  /**
+   * Starts one worker per entry of nodes_, pinned to the matching entry of
+   * cpus_ unless that is empty.
+   */
+  void start(const std::vector<unsigned>& nodes_, const std::vector<unsigned>& cpus_)
+  {
+    const size_t num_threads = nodes_.size();
+    if constexpr (stats_enabled)
+    {
+      for (size_t i = 0; i < num_threads; ++i)
+      {
+        _worker_counters.emplace_back(std::make_unique<worker_counters>());
+      }
+    }
+
+    if (_scheduling == scheduling::work_stealing)
+    {
+      for (size_t i = 0; i < num_threads; ++i)
+      {
+        auto& local = _local_tasks.emplace_back(std::make_unique<local_queue>());
+
+        // Starting from our neighbour so that the thieves spread out, the
+        // workers on our node and then everybody else.
+        for (const bool same_node : {true, false})
+        {
+          for (size_t j = 1; j < num_threads; ++j)
+          {
+            const size_t victim = (i + j) % num_threads;
+            if ((nodes_[victim] == nodes_[i]) == same_node)
+            {
+              local->victims.push_back(victim);
+            }
+          }
+        }
+      }
+    }
+
+    for (size_t i = 0; i < num_threads; ++i)
+    {
+      _threads.emplace_back(std::thread([this, i] { this->thread_loop(i); }));
+      if (cpus_.empty())
+      {
+        continue;
+      }
+
+      if (const int error = pin_to_cpu(_threads.back(), cpus_[i]))
+      {
+        sync_stop();
+        throw std::system_error(
+            error, std::system_category(), "Cannot pin a worker to cpu " + std::to_string(cpus_[i]));
+      }
+    }
+  }
+
+  /**
+   * The stop task. It goes to the back of the queue until every task that
+   * was submitted before it has been picked up, whatever their priority.
+   */
+  void stop_when_idle()
+  {
+    {
+      std::lock_guard l(_m);
+      if (!_tasks.empty())
+      {
+        unsafe_add_task(small_task([this] { stop_when_idle(); }), task_priority::background);
+        return;
+      }
+      _running = false;
+    }
+    _cv.notify_all();
+  }
+
+  /**
+   * What the tasks of a bulk submission share: they count down together and
+   * the last one to finish completes the promise, with the first exception
+   * thrown if any, or with what finish computes.
+   */
+  template <typename Result>
+  struct bulk_state
+  {
+    explicit bulk_state(size_t tasks_) : remaining(tasks_) {}
+
+    template <typename Callable>
+    void run(Callable& task_)
+    {
+      try
+      {
+        task_();
+      }
+      catch (...)
+      {
+        if (!failed.exchange(true))
+        {
+          error = std::current_exception();
+        }
+      }
+
+      if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      {
+        complete();
+      }
+    }
+
+    void complete()
+    {
+      if (failed)
+      {
+        done.set_exception(error);
+        return;
+      }
+
+      try
+      {
+        if constexpr (std::is_void_v<Result>)
+        {
+          done.set_value();
+        }
+        else
+        {
+          done.set_value(finish());
+        }
+      }
+      catch (...)
+      {
+        done.set_exception(std::current_exception());
+      }
+    }
 
+    std::atomic_size_t remaining;
+    std::atomic_bool failed{};
+    std::exception_ptr error;
+    std::promise<Result> done;
+    // Only used when there is a result to compute
+    std::function<Result()> finish;
+  };
+
+  template <typename Result, typename Range>
+  std::future<Result> submit_bulk(std::shared_ptr<bulk_state<Result>> state_,
+                                  Range&& tasks_,
+                                  task_priority priority_)
+  {
+    std::future<Result> f = state_->done.get_future();
+    if (state_->remaining == 0)
+    {
+      state_->complete();
+      return f;
+    }
+
+    enqueue_all(tasks_ | std::views::transform(
+                             [&state_](auto&& task_)
+                             {
+                               return small_task(
+                                   [s = state_, t = std::forward<decltype(task_)>(task_)]() mutable
+                                   { s->run(t); });
+                             }),
+                priority_);
     return f;
   }
 
-  void add_task(Task&& task_)
+  template <std::integral Index>
+  static std::pair<Index, Index> chunk_bounds(Index begin_,
+                                              size_t size_,
+                                              size_t grain_,
+                                              size_t chunk_)
   {
-    std::lock_guard l(_m);
-    unsafe_add_task(std::move(task_));
+    const size_t first = chunk_ * grain_;
+    const size_t last = std::min(size_, first + grain_);
+    return {static_cast<Index>(begin_ + static_cast<Index>(first)),
+            static_cast<Index>(begin_ + static_cast<Index>(last))};
+  }
+
+  size_t auto_grain(size_t size_) const
+  {
+    constexpr size_t chunks_per_worker = 4;
+    const size_t chunks = _threads.size() * chunks_per_worker;
+    return std::max<size_t>(1, (size_ + chunks - 1) / chunks);
   }
 
   /**
-   * Blocks until all the threads complete what they are doing and stop
-   * @throw std::runtime_error if any of the tasks threw an error
+   * Order is either a task_priority or a deadline.
    */
-  void sync_stop()
+  template <typename Order>
+  void enqueue(small_task&& task_, Order order_)
   {
-    if (!_running)
+    enqueue_all(std::span<small_task>(&task_, 1), order_);
+  }
+
+  template <std::ranges::input_range Range, typename Order>
+  void enqueue_all(Range&& tasks_, Order order_)
+  {
+    // Anything that has to go before the normal tasks is only ordered in the
+    // shared queue.
+    bool local = _scheduling == scheduling::work_stealing && _current_worker.pool == this;
+    if constexpr (std::is_same_v<Order, task_priority>)
     {
-      return;
+      local = local && order_ == task_priority::normal;
+    }
+    else
+    {
+      local = false;
     }
 
-    Task stop_task([this] { _running = false; });
+    size_t added{};
+    if (local)
+    {
+      local_queue& local = *_local_tasks[_current_worker.index];
+      for (auto&& task : tasks_)
+      {
+        local.tasks.push(acquire_node(local, small_task(std::move(task))));
+        ++added;
+      }
 
-    add_task(std::move(stop_task));
+      // Pairs with the fence in park(): either the parking worker sees the
+      // task or we see that it is parking.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (_sleepers.load(std::memory_order_relaxed))
+      {
+        // Taking the lock makes sure the worker is not between checking for
+        // work and waiting, or it would miss the notification.
+        {
+          std::lock_guard l(_m);
+        }
+        wake(added);
+      }
+      return;
+    }
 
-    for (auto& t : _threads)
     {
-      if (t.joinable())
+      std::lock_guard l(_m);
+      for (auto&& task : tasks_)
       {
-        t.join();
+        unsafe_add_task(small_task(std::move(task)), order_);
+        ++added;
       }
     }
+    if (_sleepers.load(std::memory_order_relaxed))
+    {
+      wake(added);
+    }
   }
 
-  private:
-  void thread_loop()
+  void wake(size_t tasks_)
   {
+    if (tasks_ == 1)
+    {
+      _cv.notify_one();
+    }
+    else
+    {
+      _cv.notify_all();
+    }
+  }
+
+  void thread_loop(size_t index_)
+  {
+    _current_worker = {this, index_};
+
+    size_t spin_limit = _spin_iterations;
+    clock::time_point idle_since{};
+    if constexpr (stats_enabled)
+    {
+      idle_since = clock::now();
+    }
+
     while (_running)
     {
-      std::optional<Task> t = pop_task();
+      queued_task t = pop_task(index_);
+
+      // Nothing to do, poll for a bit before going to sleep.
+      for (size_t i = 0; !t && i < spin_limit && _running; ++i)
+      {
+        cpu_relax();
+        t = pop_task(index_);
+      }
 
       if (t)
       {
-        assert(t->valid());
+        // Spinning, if we got there, paid off: allow a little more of it.
+        spin_limit = std::min(_spin_iterations, spin_limit * 2 + 1);
 
         // Now run the task.
-        t->operator()();
+        run(index_, t, idle_since);
       }
       else
       {
-        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        spin_limit /= 2;
+        park(index_);
       }
     }
+
+    // Nobody is going to steal from us anymore, finish what was submitted
+    // from this worker before stopping. These count like any other task.
+    if (_scheduling == scheduling::work_stealing)
+    {
+      while (std::optional<task_node*> t = _local_tasks[index_]->tasks.take())
+      {
+        count_taken(index_, worker_counters::source::local);
+        queued_task task = adopt(*t);
+        run(index_, task, idle_since);
+      }
+    }
+
+    _current_worker = {};
   }
 
-  std::optional<Task> pop_task()
+  template <typename Task>
+  void run(size_t index_, Task& task_, clock::time_point& idle_since_)
   {
+    if constexpr (stats_enabled)
+    {
+      const clock::time_point start = clock::now();
+      task_();
+      const clock::time_point end = clock::now();
+      _worker_counters[index_]->task_ran(
+          start - idle_since_, start - task_.submitted, end - start);
+      idle_since_ = end;
+    }
+    else
+    {
+      task_();
+    }
+  }
+
+  queued_task pop_task(size_t index_)
+  {
+    using source = worker_counters::source;
+
+    if (_urgent_tasks.load(std::memory_order_acquire))
+    {
+      if (queued_task t = pop_shared_task())
+      {
+        count_taken(index_, source::shared);
+        return t;
+      }
+    }
+
+    if (_scheduling == scheduling::work_stealing)
+    {
+      if (std::optional<task_node*> t = _local_tasks[index_]->tasks.take())
+      {
+        count_taken(index_, source::local);
+        return adopt(*t);
+      }
+    }
+
+    if (queued_task t = pop_shared_task())
+    {
+      count_taken(index_, source::shared);
+      return t;
+    }
+
+    if (_scheduling == scheduling::work_stealing)
+    {
+      for (const size_t victim : _local_tasks[index_]->victims)
+      {
+        if (std::optional<task_node*> t = _local_tasks[victim]->tasks.steal())
+        {
+          count_taken(index_, source::stolen);
+          return adopt(*t);
+        }
+      }
+    }
+
+    return {};
+  }
+
+  void count_taken(size_t index_, worker_counters::source source_)
+  {
+    if constexpr (stats_enabled)
+    {
+      _worker_counters[index_]->task_taken(source_);
+    }
+  }
+
+  queued_task pop_shared_task()
+  {
+    // Keep the lock out of the way of spinning workers when there is nothing
+    // to take.
+    if (!_shared_tasks.load(std::memory_order_acquire))
+    {
+      return {};
+    }
+
     std::lock_guard<std::mutex> l(_m);
-    std::optional<Task> t;
     if (_tasks.empty())
     {
-      return t;
+      return {};
+    }
+
+    queued_task t = _tasks.pop();
+    publish_shared_sizes();
+    return t;
+  }
+
+  /**
+   * Sleeps until there might be something to do.
+   */
+  void park(size_t index_)
+  {
+    std::unique_lock l(_m);
+    _sleepers.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    _cv.wait(l, [this, index_] { return !_running || has_tasks(index_); });
+
+    _sleepers.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  /**
+   * Whether there is anything for the worker to take or steal. Needs _m.
+   */
+  bool has_tasks(size_t index_) const
+  {
+    if (!_tasks.empty())
+    {
+      return true;
+    }
+
+    for (size_t i = 0; i < _local_tasks.size(); ++i)
+    {
+      if (i != index_ && !_local_tasks[i]->tasks.empty())
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  static void cpu_relax()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#else
+    std::this_thread::yield();
+#endif
+  }
+
+  struct task_node
+  {
+    queued_task task;
+    task_node* next{};
+    // The local queue whose node pool it comes from
+    size_t owner{};
+  };
+
+  /**
+   * A worker's deque for work stealing, plus the pool of nodes the tasks
+   * travel in. Nodes are taken from free_nodes by the owner only; a thief
+   * that runs a task gives its node back through returned_nodes.
+   */
+  struct local_queue
+  {
+    chase_lev_deque<task_node*> tasks;
+    task_node* free_nodes{};
+    // Who to steal from, in order
+    std::vector<size_t> victims;
+    alignas(64) std::atomic<task_node*> returned_nodes{};
+  };
+
+  task_node* acquire_node(local_queue& local_, small_task&& task_)
+  {
+    if (!local_.free_nodes)
+    {
+      // Taking the whole list at once means no ABA to worry about.
+      local_.free_nodes = local_.returned_nodes.exchange(nullptr, std::memory_order_acquire);
+    }
+
+    task_node* node = local_.free_nodes;
+    if (node)
+    {
+      local_.free_nodes = node->next;
     }
     else
     {
+      node = new task_node;
+      node->owner = _current_worker.index;
+    }
 
-      t = std::move(_tasks.back());
-      _tasks.pop_back();
-      return t;
+    node->task = make_queued(std::move(task_));
+    return node;
+  }
+
+  /**
+   * Runs on a worker of this pool.
+   */
+  queued_task adopt(task_node* node_)
+  {
+    queued_task t = std::move(node_->task);
+
+    local_queue& owner = *_local_tasks[node_->owner];
+    if (node_->owner == _current_worker.index)
+    {
+      node_->next = owner.free_nodes;
+      owner.free_nodes = node_;
     }
+    else
+    {
+      node_->next = owner.returned_nodes.load(std::memory_order_relaxed);
+      while (!owner.returned_nodes.compare_exchange_weak(
+          node_->next, node_, std::memory_order_release, std::memory_order_relaxed))
+      {
+      }
+    }
+
+    return t;
   }
 
-  void unsafe_add_task(Task&& task_)
+  static void delete_nodes(task_node* node_)
   {
-    assert(task_.valid());
-    _tasks.emplace_front(std::move(task_));
+    while (node_)
+    {
+      delete std::exchange(node_, node_->next);
+    }
+  }
+
+  template <typename Order>
+  void unsafe_add_task(small_task&& task_, Order order_)
+  {
+    assert(task_);
+    _tasks.push(make_queued(std::move(task_)), order_);
+    publish_shared_sizes();
   }
 
+  /**
+   * Needs _m.
+   */
+  void publish_shared_sizes()
+  {
+    _shared_tasks.store(_tasks.size(), std::memory_order_release);
+    _urgent_tasks.store(_tasks.urgent(), std::memory_order_release);
+  }
+
+  struct worker_context
+  {
+    const simple_thread_pool* pool;
+    size_t index;
+  };
+
+  // Which pool, if any, the calling thread is a worker of.
+  static inline thread_local worker_context _current_worker{};
+
   std::mutex _m;
+  std::condition_variable _cv;
   std::atomic_bool _running{};
-  std::list<Task> _tasks;
+  const scheduling _scheduling;
+  const size_t _spin_iterations;
+  priority_task_queue<queued_task> _tasks;
+  // Mirror _tasks.size() and _tasks.urgent(), so that they can be checked
+  // without the lock.
+  std::atomic_size_t _shared_tasks{};
+  std::atomic_size_t _urgent_tasks{};
+  // How many workers are parked, or about to.
+  std::atomic_size_t _sleepers{};
+
+  // One per worker, only used for work stealing
+  std::vector<std::unique_ptr<local_queue>> _local_tasks;
+
+  // One per worker, only used for the stats
+  std::vector<std::unique_ptr<worker_counters>> _worker_counters;
 
   std::list<std::thread> _threads;
   std::exception_ptr _exception{};
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/**
+ * A move only void() callable, like std::move_only_function, that keeps
+ * callables of up to inline_size bytes inside itself instead of on the heap.
+ * A task fills exactly one cache line.
+ */
+class small_task
+{
+  public:
+  static constexpr size_t inline_size = 64 - sizeof(void*);
+
+  small_task() = default;
+
+  template <typename Callable>
+    requires(!std::is_same_v<std::remove_cvref_t<Callable>, small_task> &&
+             std::is_invocable_v<std::remove_cvref_t<Callable>&>)
+  small_task(Callable&& callable_)
+  {
+    using F = std::remove_cvref_t<Callable>;
+    if constexpr (fits_inline<F>())
+    {
+      new (_storage) F(std::forward<Callable>(callable_));
+      _vtable = &inline_vtable<F>;
+    }
+    else
+    {
+      new (_storage) F*(new F(std::forward<Callable>(callable_)));
+      _vtable = &heap_vtable<F>;
+    }
+  }
+
+  small_task(small_task&& other_) noexcept { take(other_); }
+
+  small_task& operator=(small_task&& other_) noexcept
+  {
+    if (this != &other_)
+    {
+      reset();
+      take(other_);
+    }
+    return *this;
+  }
+
+  small_task(const small_task&) = delete;
+  small_task& operator=(const small_task&) = delete;
+
+  ~small_task() { reset(); }
+
+  explicit operator bool() const { return _vtable != nullptr; }
+
+  void operator()()
+  {
+    _vtable->invoke(_storage);
+  }
+
+  void reset()
+  {
+    if (_vtable)
+    {
+      _vtable->destroy(_storage);
+      _vtable = nullptr;
+    }
+  }
+
+  /**
+   * Whether a callable of type F is stored without allocating.
+   */
+  template <typename F>
+  static constexpr bool fits_inline()
+  {
+    return sizeof(F) <= inline_size && alignof(F) <= alignof(std::max_align_t) &&
+           std::is_nothrow_move_constructible_v<F>;
+  }
+
+  private:
+  struct vtable
+  {
+    void (*invoke)(void*);
+    // Move constructs into the first storage from the second one and
+    // destroys what was left there.
+    void (*relocate)(void*, void*) noexcept;
+    void (*destroy)(void*) noexcept;
+  };
+
+  template <typename F>
+  static constexpr vtable inline_vtable{
+      [](void* f_) { std::invoke(*static_cast<F*>(f_)); },
+      [](void* to_, void* from_) noexcept
+      {
+        F* const from = static_cast<F*>(from_);
+        new (to_) F(std::move(*from));
+        from->~F();
+      },
+      [](void* f_) noexcept { static_cast<F*>(f_)->~F(); }};
+
+  template <typename F>
+  static constexpr vtable heap_vtable{
+      [](void* f_) { std::invoke(**static_cast<F**>(f_)); },
+      [](void* to_, void* from_) noexcept { new (to_) F*(*static_cast<F**>(from_)); },
+      [](void* f_) noexcept { delete *static_cast<F**>(f_); }};
+
+  void take(small_task& other_) noexcept
+  {
+    if (other_._vtable)
+    {
+      other_._vtable->relocate(_storage, other_._storage);
+      _vtable = std::exchange(other_._vtable, nullptr);
+    }
+  }
+
+  alignas(std::max_align_t) std::byte _storage[inline_size];
+  const vtable* _vtable{};
+};
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <cassert>
+#include <concepts>
+#include <coroutine>
+#include <exception>
+#include <future>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+/**
+ * Where a task keeps what it returned or threw.
+ */
+template <typename T>
+class task_result
+{
+  static_assert(!std::is_reference_v<T>);
+
+  public:
+  template <typename U>
+    requires std::convertible_to<U, T>
+  void return_value(U&& value_)
+  {
+    _result.template emplace<1>(std::forward<U>(value_));
+  }
+
+  void unhandled_exception() { _result.template emplace<2>(std::current_exception()); }
+
+  T result()
+  {
+    if (_result.index() == 2)
+    {
+      std::rethrow_exception(std::get<2>(_result));
+    }
+    return std::move(std::get<1>(_result));
+  }
+
+  private:
+  std::variant<std::monostate, T, std::exception_ptr> _result;
+};
+
+template <>
+class task_result<void>
+{
+  public:
+  void return_void() {}
+
+  void unhandled_exception() { _exception = std::current_exception(); }
+
+  void result()
+  {
+    if (_exception)
+    {
+      std::rethrow_exception(_exception);
+    }
+  }
+
+  private:
+  std::exception_ptr _exception;
+};
+
+/**
+ * A coroutine returning T, in the spirit of cppcoro's task: it only starts
+ * when it is co_awaited, and when it is done it resumes whoever awaited it,
+ * on whichever thread it finished. Neither step blocks a thread, so a chain
+ * of tasks moving on and off simple_thread_pool with schedule() never ties
+ * up a worker while it waits.
+ *
+ * Use spawn() to start one from outside a coroutine.
+ */
+template <typename T = void>
+class task
+{
+  struct final_awaiter
+  {
+    bool await_ready() const noexcept { return false; }
+
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> coroutine_) noexcept
+    {
+      return coroutine_.promise().continuation;
+    }
+
+    void await_resume() const noexcept {}
+  };
+
+  public:
+  struct promise_type : task_result<T>
+  {
+    task get_return_object()
+    {
+      return task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+
+    final_awaiter final_suspend() const noexcept { return {}; }
+
+    std::coroutine_handle<> continuation{std::noop_coroutine()};
+  };
+
+  task(task&& other_) noexcept : _coroutine(std::exchange(other_._coroutine, {})) {}
+
+  task& operator=(task&& other_) noexcept
+  {
+    if (this != &other_)
+    {
+      destroy();
+      _coroutine = std::exchange(other_._coroutine, {});
+    }
+    return *this;
+  }
+
+  task(const task&) = delete;
+  task& operator=(const task&) = delete;
+
+  ~task() { destroy(); }
+
+  /**
+   * Runs the task and resumes the awaiting coroutine with its result.
+   */
+  auto operator co_await() && noexcept
+  {
+    struct awaiter
+    {
+      bool await_ready() const noexcept { return false; }
+
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting_) noexcept
+      {
+        coroutine.promise().continuation = awaiting_;
+        return coroutine;
+      }
+
+      T await_resume() { return coroutine.promise().result(); }
+
+      std::coroutine_handle<promise_type> coroutine;
+    };
+
+    assert(_coroutine);
+    return awaiter{_coroutine};
+  }
+
+  private:
+  explicit task(std::coroutine_handle<promise_type> coroutine_) : _coroutine(coroutine_) {}
+
+  void destroy()
+  {
+    if (_coroutine)
+    {
+      _coroutine.destroy();
+    }
+  }
+
+  std::coroutine_handle<promise_type> _coroutine;
+};
+
+/**
+ * A coroutine nobody waits for, it frees itself when it is done.
+ */
+struct detached_task
+{
+  struct promise_type
+  {
+    detached_task get_return_object() const noexcept { return {}; }
+    std::suspend_never initial_suspend() const noexcept { return {}; }
+    std::suspend_never final_suspend() const noexcept { return {}; }
+    void return_void() const noexcept {}
+    void unhandled_exception() const noexcept { std::terminate(); }
+  };
+};
+
+template <typename T>
+detached_task run_detached(task<T> task_, std::promise<T> promise_)
+{
+  try
+  {
+    if constexpr (std::is_void_v<T>)
+    {
+      co_await std::move(task_);
+      promise_.set_value();
+    }
+    else
+    {
+      promise_.set_value(co_await std::move(task_));
+    }
+  }
+  catch (...)
+  {
+    promise_.set_exception(std::current_exception());
+  }
+}
+
+/**
+ * Starts task_ on the calling thread, where it runs until it first suspends,
+ * typically on simple_thread_pool::schedule(). The future is ready once the
+ * task is done.
+ */
+template <typename T>
+std::future<T> spawn(task<T> task_)
+{
+  std::promise<T> p;
+  std::future<T> f = p.get_future();
+  run_detached(std::move(task_), std::move(p));
+  return f;
+}
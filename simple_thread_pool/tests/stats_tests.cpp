@@ -0,0 +1,147 @@
+#include <atomic>
+#include <chrono>
+#include <latch>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+#include "pool_stats.hpp"
+#include "simple_thread_pool.hpp"
+
+static_assert(simple_thread_pool::stats_enabled);
+
+TEST(latency_histogram, buckets_by_powers_of_two)
+{
+  using std::chrono::nanoseconds;
+
+  EXPECT_EQ(0u, latency_histogram::bucket(nanoseconds(0)));
+  EXPECT_EQ(1u, latency_histogram::bucket(nanoseconds(1)));
+  EXPECT_EQ(2u, latency_histogram::bucket(nanoseconds(3)));
+  EXPECT_EQ(11u, latency_histogram::bucket(nanoseconds(1024)));
+  EXPECT_EQ(latency_histogram::buckets - 1, latency_histogram::bucket(std::chrono::hours(1)));
+
+  latency_histogram h;
+  EXPECT_EQ(nanoseconds(0), h.quantile(0.5));
+
+  h.counts[latency_histogram::bucket(nanoseconds(100))] = 99;
+  h.counts[latency_histogram::bucket(nanoseconds(5000))] = 1;
+  EXPECT_EQ(100u, h.count());
+  EXPECT_EQ(nanoseconds(128), h.quantile(0.5));
+  EXPECT_EQ(nanoseconds(128), h.quantile(0.99));
+  EXPECT_EQ(nanoseconds(8192), h.quantile(1));
+}
+
+TEST(simple_thread_pool_stats, counts_every_task)
+{
+  for (const scheduling s : {scheduling::shared_queue, scheduling::work_stealing})
+  {
+    simple_thread_pool pool(2, s);
+    pool.parallel_for(0, 1000, 1, [](int) { std::this_thread::yield(); }).get();
+
+    // The last task is counted right after it completes the future.
+    pool_stats stats = pool.snapshot();
+    while (stats.total().tasks_run < 1000)
+    {
+      std::this_thread::yield();
+      stats = pool.snapshot();
+    }
+    ASSERT_EQ(2u, stats.workers.size());
+
+    const worker_stats total = stats.total();
+    EXPECT_EQ(1000u, total.tasks_run);
+    EXPECT_EQ(total.tasks_run, total.shared_tasks + total.local_tasks + total.stolen_tasks);
+    EXPECT_EQ(1000u, total.wait_time.count());
+    EXPECT_EQ(1000u, total.run_time.count());
+    EXPECT_GT(total.busy_time.count(), 0);
+  }
+}
+
+TEST(simple_thread_pool_stats, sees_queued_and_stolen_tasks)
+{
+  simple_thread_pool pool(2, scheduling::work_stealing);
+  std::latch release(1);
+  std::atomic_int started{};
+
+  // One worker queues up tasks on its own deque and blocks, the other one
+  // has to steal them.
+  auto spawner = pool.add_task2(
+      [&]
+      {
+        for (int i = 0; i < 100; ++i)
+        {
+          pool.add_task2([&] { release.wait(); ++started; });
+        }
+        release.wait();
+      });
+
+  while (started == 0 && pool.snapshot().queued_local == 0)
+  {
+    std::this_thread::yield();
+  }
+  release.count_down();
+  spawner.get();
+  pool.sync_stop();
+
+  const worker_stats total = pool.snapshot().total();
+  EXPECT_EQ(100, started);
+  EXPECT_GT(total.stolen_tasks, 0u);
+}
+
+TEST(simple_thread_pool_stats, counts_tasks_finished_while_stopping)
+{
+  simple_thread_pool pool(2, scheduling::work_stealing);
+  std::latch release(1);
+  std::latch stopped(1);
+  std::atomic<std::thread::id> spawner_thread;
+  std::atomic_int started{};
+
+  // Both workers end up blocked on a task of the spawner's deque, with the
+  // rest still queued behind them.
+  auto spawner = pool.add_task2(
+      [&]
+      {
+        spawner_thread = std::this_thread::get_id();
+        for (int i = 0; i < 100; ++i)
+        {
+          pool.add_task2(
+              [&]
+              {
+                ++started;
+                release.wait();
+                // Keep the spawner's worker busy until the other one has
+                // stopped the pool, so it leaves its deque to the drain.
+                if (std::this_thread::get_id() == spawner_thread)
+                {
+                  stopped.wait();
+                }
+              });
+        }
+      });
+  spawner.get();
+  while (started < 2)
+  {
+    std::this_thread::yield();
+  }
+
+  std::jthread stopper([&] { pool.sync_stop(); });
+  while (pool.snapshot().queued_shared == 0)
+  {
+    std::this_thread::yield();
+  }
+
+  // The other worker takes the stop task as soon as it is free
+  release.count_down();
+  while (pool.snapshot().queued_shared != 0)
+  {
+    std::this_thread::yield();
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  stopped.count_down();
+  stopper.join();
+
+  const worker_stats total = pool.snapshot().total();
+  EXPECT_EQ(100, started);
+  EXPECT_EQ(100u, total.local_tasks + total.stolen_tasks);
+  EXPECT_EQ(total.tasks_run, total.shared_tasks + total.local_tasks + total.stolen_tasks);
+  EXPECT_EQ(total.tasks_run, total.run_time.count());
+}
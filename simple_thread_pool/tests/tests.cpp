@@ -1,14 +1,53 @@
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <functional>
 #include <future>
+#include <latch>
 #include <limits>
 #include <random>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "gtest/gtest.h"
 
+#include "block_pool.hpp"
+#include "chase_lev_deque.hpp"
+#include "cpu_topology.hpp"
+#include "pool_stats.hpp"
+#include "priority_task_queue.hpp"
+#include "ring_queue.hpp"
 #include "simple_thread_pool.hpp"
+#include "small_task.hpp"
+#include "task.hpp"
+
+namespace
+{
+// Counts every heap allocation in the process, like allocCatcher does.
+std::atomic_size_t allocations{};
+} // namespace
+
+void* operator new(size_t s)
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* ptr = malloc(s ? s : 1))
+  {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void* operator new(size_t s, const std::nothrow_t&) noexcept
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return malloc(s ? s : 1);
+}
+
+void operator delete(void* ptr_) noexcept { free(ptr_); }
+void operator delete(void* ptr_, size_t) noexcept { free(ptr_); }
 
 TEST(simple_thread_pool, no_tasks) { simple_thread_pool pool; }
 
@@ -72,3 +111,534 @@ TEST(simple_thread_pool, one_task2_except)
   auto fut = pool.add_task2([]() { throw std::runtime_error("ERROR!"); });
   EXPECT_THROW(fut.get(), std::runtime_error);
 }
+
+TEST(chase_lev_deque, owner_is_lifo_thieves_are_fifo)
+{
+  // Small enough to have to grow
+  chase_lev_deque<int> d(2);
+  EXPECT_FALSE(d.take());
+  EXPECT_FALSE(d.steal());
+
+  for (int i = 0; i < 10; ++i)
+  {
+    d.push(i);
+  }
+
+  EXPECT_EQ(9, d.take());
+  EXPECT_EQ(0, d.steal());
+  EXPECT_EQ(8, d.take());
+  EXPECT_EQ(1, d.steal());
+
+  std::vector<int> rest;
+  while (std::optional<int> i = d.take())
+  {
+    rest.push_back(*i);
+  }
+  EXPECT_EQ((std::vector<int>{7, 6, 5, 4, 3, 2}), rest);
+  EXPECT_TRUE(d.empty());
+}
+
+TEST(chase_lev_deque, every_item_is_taken_once)
+{
+  const int total_items = 100000;
+  chase_lev_deque<int> d;
+  std::vector<std::atomic_int> seen(total_items);
+  std::atomic_bool done{};
+
+  const auto thief = [&]
+  {
+    while (!done || !d.empty())
+    {
+      if (std::optional<int> i = d.steal())
+      {
+        seen[*i]++;
+      }
+    }
+  };
+  std::vector<std::jthread> thieves;
+  for (int i = 0; i < 3; ++i)
+  {
+    thieves.emplace_back(thief);
+  }
+
+  for (int i = 0; i < total_items; ++i)
+  {
+    d.push(i);
+    if (i % 3 == 0)
+    {
+      if (std::optional<int> taken = d.take())
+      {
+        seen[*taken]++;
+      }
+    }
+  }
+  done = true;
+  thieves.clear();
+
+  while (std::optional<int> i = d.take())
+  {
+    seen[*i]++;
+  }
+
+  for (const auto& s : seen)
+  {
+    EXPECT_EQ(1, s.load());
+  }
+}
+
+TEST(simple_thread_pool, work_stealing_nested_tasks)
+{
+  const int children = 10;
+  const int grandchildren = 100;
+  std::latch all_done(1 + children + children * grandchildren);
+
+  simple_thread_pool pool(4, scheduling::work_stealing);
+  pool.add_task2(
+      [&]
+      {
+        for (int i = 0; i < children; ++i)
+        {
+          pool.add_task2(
+              [&]
+              {
+                for (int j = 0; j < grandchildren; ++j)
+                {
+                  pool.add_task2([&] { all_done.count_down(); });
+                }
+                all_done.count_down();
+              });
+        }
+        all_done.count_down();
+      });
+
+  all_done.wait();
+}
+
+TEST(simple_thread_pool, work_stealing_runs_local_tasks_before_stopping)
+{
+  std::atomic_int ran{};
+  {
+    simple_thread_pool pool(3, scheduling::work_stealing);
+    pool.add_task2(
+        [&]
+        {
+          for (int i = 0; i < 1000; ++i)
+          {
+            pool.add_task2([&] { ran++; });
+          }
+        });
+    pool.sync_stop();
+  }
+  EXPECT_EQ(1000, ran);
+}
+
+TEST(simple_thread_pool, parked_workers_wake_up)
+{
+  // No spinning, so that every task has to wake a parked worker, from outside
+  // the pool and, with work stealing, from another worker.
+  for (const scheduling s : {scheduling::shared_queue, scheduling::work_stealing})
+  {
+    simple_thread_pool pool(3, s, 0);
+    for (int i = 0; i < 200; ++i)
+    {
+      if (i % 50 == 0)
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      }
+
+      auto fut = pool.add_task2(
+          [&pool]
+          {
+            std::latch nested_done(2);
+            pool.add_task2([&] { nested_done.count_down(); });
+            pool.add_task2([&] { nested_done.count_down(); });
+            nested_done.wait();
+            return 1;
+          });
+      EXPECT_EQ(1, fut.get());
+    }
+  }
+}
+
+TEST(small_task, stores_small_callables_inline)
+{
+  int calls{};
+  small_task t([&calls] { ++calls; });
+  EXPECT_TRUE(t);
+
+  small_task moved(std::move(t));
+  EXPECT_FALSE(t);
+  moved();
+  EXPECT_EQ(1, calls);
+
+  // Too big to fit, goes to the heap but behaves the same
+  std::array<char, 2 * small_task::inline_size> big{};
+  big[0] = 2;
+  static_assert(!small_task::fits_inline<decltype([big] {})>());
+  t = small_task([&calls, big] { calls += big[0]; });
+  moved = std::move(t);
+  moved();
+  EXPECT_EQ(3, calls);
+
+  // Move only callables are fine
+  auto owned = std::make_unique<int>(4);
+  small_task move_only([&calls, owned = std::move(owned)] { calls += *owned; });
+  move_only();
+  EXPECT_EQ(7, calls);
+}
+
+TEST(ring_queue, grows_and_keeps_fifo_order)
+{
+  ring_queue<int> q(2);
+  int next_popped{};
+  for (int i = 0; i < 100; ++i)
+  {
+    q.push_back(int{i});
+    if (i % 3 == 0)
+    {
+      EXPECT_EQ(next_popped++, q.pop_front());
+    }
+  }
+  while (!q.empty())
+  {
+    EXPECT_EQ(next_popped++, q.pop_front());
+  }
+  EXPECT_EQ(100, next_popped);
+}
+
+TEST(simple_thread_pool, small_tasks_do_not_allocate)
+{
+  for (const scheduling s : {scheduling::shared_queue, scheduling::work_stealing})
+  {
+    simple_thread_pool pool(2, s);
+
+    // Submits from outside the pool, and from a worker so that with work
+    // stealing the tasks go through the local deques.
+    const auto submit_batch = [&pool]
+    {
+      std::array<std::future<int>, 100> futures;
+      for (int i = 0; i < static_cast<int>(futures.size()); ++i)
+      {
+        futures[i] = pool.add_task2([i] { return i; });
+      }
+      int sum{};
+      for (auto& f : futures)
+      {
+        sum += f.get();
+      }
+
+      sum += pool
+                 .add_task2(
+                     [&pool]
+                     {
+                       std::array<std::future<int>, 100> nested;
+                       for (int i = 0; i < static_cast<int>(nested.size()); ++i)
+                       {
+                         nested[i] = pool.add_task2([i] { return i; });
+                       }
+                       int nested_sum{};
+                       for (auto& f : nested)
+                       {
+                         nested_sum += f.get();
+                       }
+                       return nested_sum;
+                     })
+                 .get();
+      return sum;
+    };
+
+    // Warm up the queues and the pools: they only grow when they run short,
+    // so wait until they have not needed to for a while.
+    for (int i = 0, quiet_batches = 0; quiet_batches < 500 && i < 20000; ++i)
+    {
+      const size_t warming = allocations.load();
+      EXPECT_EQ(2 * 4950, submit_batch());
+      quiet_batches = allocations.load() == warming ? quiet_batches + 1 : 0;
+    }
+
+    const size_t before = allocations.load();
+    for (int i = 0; i < 20; ++i)
+    {
+      EXPECT_EQ(2 * 4950, submit_batch());
+    }
+    EXPECT_EQ(before, allocations.load());
+  }
+}
+
+TEST(simple_thread_pool, add_tasks)
+{
+  for (const scheduling s : {scheduling::shared_queue, scheduling::work_stealing})
+  {
+    simple_thread_pool pool(3, s);
+
+    std::atomic_int ran{};
+    std::vector<std::function<void()>> tasks(100, [&ran] { ran++; });
+    pool.add_tasks(tasks).get();
+    EXPECT_EQ(100, ran);
+
+    // Nothing to run is ready straight away
+    pool.add_tasks(std::vector<std::function<void()>>{}).get();
+
+    // All of them run even if one throws, and the error comes out of get()
+    tasks.push_back([] { throw std::runtime_error("ERROR!"); });
+    auto fut = pool.add_tasks(tasks);
+    EXPECT_THROW(fut.get(), std::runtime_error);
+    EXPECT_EQ(200, ran);
+  }
+}
+
+TEST(simple_thread_pool, parallel_for)
+{
+  simple_thread_pool pool(3);
+
+  std::vector<int> squares(1000);
+  pool.parallel_for(0, 1000, 64, [&squares](int i) { squares[i] = i * i; }).get();
+  for (int i = 0; i < 1000; ++i)
+  {
+    EXPECT_EQ(i * i, squares[i]);
+  }
+
+  // Picks its own grain, and handles a range that does not start at 0
+  std::vector<std::atomic_int> hits(1000);
+  pool.parallel_for(size_t{10}, size_t{1000}, 0, [&hits](size_t i) { hits[i]++; }).get();
+  for (size_t i = 0; i < hits.size(); ++i)
+  {
+    EXPECT_EQ(i < 10 ? 0 : 1, hits[i].load());
+  }
+
+  pool.parallel_for(5, 5, 0, [](int) { FAIL(); }).get();
+}
+
+TEST(simple_thread_pool, parallel_reduce)
+{
+  for (const scheduling s : {scheduling::shared_queue, scheduling::work_stealing})
+  {
+    simple_thread_pool pool(3, s);
+
+    auto sum_of_squares = pool.parallel_reduce(
+        int64_t{1}, int64_t{100001}, 0, int64_t{}, [](int64_t i) { return i * i; }, std::plus<>());
+    EXPECT_EQ(int64_t{333338333350000}, sum_of_squares.get());
+
+    // Partial results are combined in order
+    auto digits = pool.parallel_reduce(
+        0, 10, 3, std::string{}, [](int i) { return std::to_string(i); }, std::plus<>());
+    EXPECT_EQ("0123456789", digits.get());
+
+    auto empty = pool.parallel_reduce(0, 0, 0, 42, [](int i) { return i; }, std::plus<>());
+    EXPECT_EQ(42, empty.get());
+  }
+}
+
+TEST(priority_task_queue, orders_by_deadline_then_priority)
+{
+  std::string order;
+  auto task = [&order](char c_) { return small_task([&order, c_] { order += c_; }); };
+
+  priority_task_queue<> q;
+  const auto now = priority_task_queue<>::clock::now();
+  q.push(task('b'), task_priority::background);
+  q.push(task('n'), task_priority::normal);
+  q.push(task('h'), task_priority::high);
+  q.push(task('N'), task_priority::normal);
+  q.push(task('2'), now + std::chrono::seconds(2));
+  q.push(task('1'), now + std::chrono::seconds(1));
+  q.push(task('3'), now + std::chrono::seconds(2));
+  EXPECT_EQ(4u, q.urgent());
+  EXPECT_EQ(7u, q.size());
+
+  while (!q.empty())
+  {
+    q.pop()();
+  }
+  EXPECT_EQ("123hnNb", order);
+}
+
+TEST(priority_task_queue, lower_lanes_do_not_starve)
+{
+  std::vector<task_priority> order;
+  auto task = [&order](task_priority p_)
+  { return small_task([&order, p_] { order.push_back(p_); }); };
+
+  priority_task_queue<> q;
+  q.push(task(task_priority::background), task_priority::background);
+  for (size_t i = 0; i < 3 * priority_task_queue<>::starvation_limit; ++i)
+  {
+    q.push(task(task_priority::high), task_priority::high);
+  }
+
+  while (!q.empty())
+  {
+    q.pop()();
+  }
+
+  const auto background = std::ranges::find(order, task_priority::background);
+  EXPECT_EQ(priority_task_queue<>::starvation_limit,
+            static_cast<size_t>(background - order.begin()));
+}
+
+TEST(simple_thread_pool, runs_tasks_by_priority)
+{
+  for (const scheduling s : {scheduling::shared_queue, scheduling::work_stealing})
+  {
+    simple_thread_pool pool(1, s);
+    std::string order;
+
+    // Keep the only worker busy while the others queue up
+    std::latch queued(1);
+    auto blocker = pool.add_task2([&] { queued.wait(); });
+
+    std::vector<std::future<void>> futs;
+    futs.push_back(pool.add_task2([&] { order += 'b'; }, task_priority::background));
+    futs.push_back(pool.add_task2([&] { order += 'n'; }));
+    futs.push_back(pool.add_task2([&] { order += 'h'; }, task_priority::high));
+    futs.push_back(pool.add_task2([&] { order += 'd'; },
+                                  simple_thread_pool::clock::now() + std::chrono::hours(1)));
+    queued.count_down();
+
+    for (auto& f : futs)
+    {
+      f.get();
+    }
+    EXPECT_EQ("dhnb", order);
+  }
+}
+
+TEST(simple_thread_pool, high_priority_tasks_go_before_local_ones)
+{
+  simple_thread_pool pool(1, scheduling::work_stealing);
+  std::string order;
+
+  pool.add_task2(
+          [&]
+          {
+            pool.add_task2([&] { order += 'n'; });
+            pool.add_task2([&] { order += 'h'; }, task_priority::high);
+          })
+      .get();
+  pool.sync_stop();
+
+  EXPECT_EQ("hn", order);
+}
+
+TEST(simple_thread_pool, sync_stop_runs_every_queued_task)
+{
+  std::atomic_int ran{};
+  {
+    simple_thread_pool pool(2);
+    for (int i = 0; i < 100; ++i)
+    {
+      pool.add_task2([&] { ++ran; }, task_priority::background);
+      pool.add_task2([&] { ++ran; }, task_priority::high);
+    }
+  }
+  EXPECT_EQ(200, ran);
+}
+
+#if defined(__linux__)
+TEST(simple_thread_pool, pinned_workers_run_on_their_cpu)
+{
+  const std::vector<unsigned> cpus = available_cpus();
+  ASSERT_FALSE(cpus.empty());
+
+  for (const scheduling s : {scheduling::shared_queue, scheduling::work_stealing})
+  {
+    // A single worker, so that we know which cpu the task runs on
+    simple_thread_pool pool(std::vector<unsigned>{cpus.back()}, s);
+    EXPECT_EQ(static_cast<int>(cpus.back()), pool.add_task2([] { return sched_getcpu(); }).get());
+
+    // Every cpu we can run on
+    simple_thread_pool all(cpus, s);
+    std::atomic_int ran{};
+    all.parallel_for(0, 1000, 0, [&](int) { ++ran; }).get();
+    EXPECT_EQ(1000, ran);
+  }
+}
+
+TEST(simple_thread_pool, pinning_to_a_missing_cpu_throws)
+{
+  EXPECT_THROW(simple_thread_pool(std::vector<unsigned>{CPU_SETSIZE - 1}), std::system_error);
+}
+#endif
+
+namespace
+{
+task<std::thread::id> worker_id(simple_thread_pool& pool_)
+{
+  co_await pool_.schedule();
+  co_return std::this_thread::get_id();
+}
+
+task<int> square(simple_thread_pool& pool_, int x_)
+{
+  co_await pool_.schedule();
+  co_return x_ * x_;
+}
+
+task<int> sum_of_squares(simple_thread_pool& pool_, int n_)
+{
+  int sum = 0;
+  for (int i = 1; i <= n_; ++i)
+  {
+    sum += co_await square(pool_, i);
+  }
+  co_return sum;
+}
+
+task<> fail(simple_thread_pool& pool_)
+{
+  co_await pool_.schedule();
+  throw std::runtime_error("task failed");
+}
+} // namespace
+
+TEST(task, runs_on_the_pool)
+{
+  simple_thread_pool pool(2);
+  EXPECT_NE(std::this_thread::get_id(), spawn(worker_id(pool)).get());
+}
+
+TEST(task, awaiting_tasks_does_not_block_workers)
+{
+  // With one worker, blocking on the nested tasks would deadlock.
+  for (const scheduling s : {scheduling::shared_queue, scheduling::work_stealing})
+  {
+    simple_thread_pool pool(1, s);
+    std::vector<std::future<int>> sums;
+    for (int i = 0; i < 10; ++i)
+    {
+      sums.push_back(spawn(sum_of_squares(pool, 100)));
+    }
+    for (auto& sum : sums)
+    {
+      EXPECT_EQ(338350, sum.get());
+    }
+  }
+}
+
+TEST(task, exceptions_reach_the_awaiter)
+{
+  simple_thread_pool pool(1);
+  EXPECT_THROW(spawn(fail(pool)).get(), std::runtime_error);
+}
+
+TEST(simple_thread_pool, snapshot_shows_queued_tasks)
+{
+  simple_thread_pool pool(1);
+  std::latch release(1);
+  auto blocker = pool.add_task2([&] { release.wait(); });
+  for (int i = 0; i < 10; ++i)
+  {
+    pool.add_task2([] {});
+  }
+
+  const pool_stats stats = pool.snapshot();
+  EXPECT_LE(10u, stats.queued_shared);
+  EXPECT_EQ(0u, stats.queued_local);
+  if constexpr (!simple_thread_pool::stats_enabled)
+  {
+    // The rest is compiled out, see stats_tests.cpp
+    EXPECT_TRUE(stats.workers.empty());
+  }
+
+  release.count_down();
+}